@@ -1,4 +1,4 @@
--- complete word at primary selection location using vis-complete(1)
+-- complete word at primary selection location using the word index of all open files
 
 vis:map(vis.modes.INSERT, "<C-n>", function()
 	local win = vis.win
@@ -11,12 +11,32 @@ vis:map(vis.modes.INSERT, "<C-n>", function()
 	if range.start == range.finish then return end
 	local prefix = file:content(range)
 	if not prefix then return end
-	local cmd = string.format("vis-complete --word '%s'", prefix:gsub("'", "'\\''"))
-	local status, out, err = vis:pipe(file, { start = 0, finish = file.size }, cmd)
+	local counts = {}
+	for f in vis:files() do
+		if not f.internal then
+			for word, count in pairs(f:words(prefix) or {}) do
+				if word ~= prefix then
+					counts[word] = (counts[word] or 0) + count
+				end
+			end
+		end
+	end
+	local words = {}
+	for word in pairs(counts) do
+		table.insert(words, word)
+	end
+	if #words == 0 then return end
+	table.sort(words, function(a, b)
+		if counts[a] ~= counts[b] then return counts[a] > counts[b] end
+		return a < b
+	end)
+	local status, out, err = vis:pipe(table.concat(words, "\n") .. "\n", "vis-menu -b")
 	if status ~= 0 or not out then
 		if err then vis:info(err) end
 		return
 	end
+	out = out:gsub("\n$", "")
+	if out:sub(1, #prefix) == prefix then out = out:sub(#prefix + 1) end
 	file:insert(pos, out)
 	win.selection.pos = pos + #out
 end, "Complete word in file")
@@ -2264,6 +2264,8 @@ int main(int argc, char *argv[]) {
 			continue;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			continue;
 		} else if (strcmp(argv[i], "-v") == 0) {
 			printf("vis %s%s%s%s%s%s%s\n", VERSION,
 			       CONFIG_CURSES ? " +curses" : "",
@@ -2280,7 +2282,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	char *cmd = NULL;
-	bool end_of_options = false, win_created = false;
+	bool end_of_options = false, win_created = false, recover = false;
 
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-' && !end_of_options) {
@@ -2303,10 +2305,16 @@ int main(int argc, char *argv[]) {
 			} else if (strcmp(argv[i], "--") == 0) {
 				end_of_options = true;
 				continue;
+			} else if (strcmp(argv[i], "-r") == 0) {
+				recover = true;
+				continue;
 			}
 		} else if (argv[i][0] == '+' && !end_of_options) {
 			cmd = argv[i] + (argv[i][1] == '/' || argv[i][1] == '?');
 			continue;
+		} else if (recover) {
+			if (!vis_window_recover(vis, argv[i]))
+				vis_die(vis, "Can not recover `%s': %s\n", argv[i], strerror(errno));
 		} else if (!vis_window_new(vis, argv[i])) {
 			vis_die(vis, "Can not load `%s': %s\n", argv[i], strerror(errno));
 		}
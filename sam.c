@@ -67,6 +67,15 @@ typedef struct {
 	bool mod;       /* % every n-th match, implies n == m */
 } Count;
 
+typedef struct {            /* state of a file write performed by cmd_write */
+	Win *win;           /* window whose file is being written */
+	char *path;         /* absolute path of the destination */
+	Filerange range;    /* range to write unless in visual mode */
+	TextSave *ctx;      /* save operation, to be committed */
+	bool existing_file; /* whether the destination existed before */
+	bool same_file;     /* whether the destination is the file being edited */
+} PendingWrite;
+
 struct Command {
 	const char *argv[MAX_ARGV];/* [0]=cmd-name, [1..MAX_ARGV-2]=arguments, last element always NULL */
 	Address *address;         /* range of text for command */
@@ -137,6 +146,8 @@ static bool cmd_new(Vis*, Win*, Command*, const char *argv[], Selection*, Filera
 static bool cmd_vnew(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
 static bool cmd_wq(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
 static bool cmd_earlier_later(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
+static bool cmd_sort(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
+static bool cmd_lines(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
 static bool cmd_help(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
 static bool cmd_map(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
 static bool cmd_unmap(Vis*, Win*, Command*, const char *argv[], Selection*, Filerange*);
@@ -265,6 +276,18 @@ static const CommandDef cmds[] = {
 	}, {
 		"later",        VIS_HELP("Go to newer text state")
 		CMD_ARGV|CMD_ONCE|CMD_ADDRESS_NONE, NULL, cmd_earlier_later
+	}, {
+		"sort",         VIS_HELP("Sort lines `:sort [-n] [-r] [-u] [-k field]`")
+		CMD_ARGV|CMD_ADDRESS_ALL_1CURSOR, NULL, cmd_sort
+	}, {
+		"uniq",         VIS_HELP("Remove repeated adjacent lines")
+		CMD_ARGV|CMD_ADDRESS_ALL_1CURSOR, NULL, cmd_lines
+	}, {
+		"reverse",      VIS_HELP("Reverse order of lines")
+		CMD_ARGV|CMD_ADDRESS_ALL_1CURSOR, NULL, cmd_lines
+	}, {
+		"shuffle",      VIS_HELP("Randomly permute lines")
+		CMD_ARGV|CMD_ADDRESS_ALL_1CURSOR, NULL, cmd_lines
 	},
 	{ NULL, VIS_HELP(NULL) CMD_NONE, NULL, NULL },
 };
@@ -301,6 +324,13 @@ enum {
 	OPTION_CHANGE_256COLORS,
 	OPTION_LAYOUT,
 	OPTION_IGNORECASE,
+	OPTION_JOURNAL,
+	OPTION_AUTORELOAD,
+	OPTION_UNDOFILE,
+	OPTION_UNDOLEVELS,
+	OPTION_UNDOSIZE,
+	OPTION_UNDOMEMORY,
+	OPTION_UNDODIR,
 };
 
 static const OptionDef options[] = {
@@ -372,7 +402,7 @@ static const OptionDef options[] = {
 	[OPTION_SAVE_METHOD] = {
 		{ "savemethod" },
 		VIS_OPTION_TYPE_STRING|VIS_OPTION_NEED_WINDOW,
-		VIS_HELP("Save method to use for current file 'auto', 'atomic' or 'inplace'")
+		VIS_HELP("Save method to use for current file 'auto', 'atomic', 'inplace' or 'incremental'")
 	},
 	[OPTION_LOAD_METHOD] = {
 		{ "loadmethod" },
@@ -394,6 +424,41 @@ static const OptionDef options[] = {
 		VIS_OPTION_TYPE_BOOL,
 		VIS_HELP("Ignore case when searching")
 	},
+	[OPTION_JOURNAL] = {
+		{ "journal" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Record unsaved changes for crash recovery")
+	},
+	[OPTION_AUTORELOAD] = {
+		{ "autoreload" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Reload unmodified files when they are changed on disk")
+	},
+	[OPTION_UNDOFILE] = {
+		{ "undofile" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Preserve undo history of saved files across editing sessions")
+	},
+	[OPTION_UNDOLEVELS] = {
+		{ "undolevels" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximal number of revisions kept for undo (0 for unlimited)")
+	},
+	[OPTION_UNDOSIZE] = {
+		{ "undosize" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximal amount of removed text kept for undo in MiB (0 for unlimited)")
+	},
+	[OPTION_UNDOMEMORY] = {
+		{ "undomemory" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Amount of undo history in MiB after which it is paged out (0 for never)")
+	},
+	[OPTION_UNDODIR] = {
+		{ "undodir" },
+		VIS_OPTION_TYPE_STRING,
+		VIS_HELP("Directory for undo history files and paged out undo data")
+	},
 };
 
 bool sam_init(Vis *vis) {
@@ -1560,8 +1625,25 @@ static bool cmd_print(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	return true;
 }
 
+static bool write_files(Vis*, Win*, Command*, const char *argv[], Filerange*, Array *pending);
+static bool write_commit_all(Vis*, Array *pending);
+
+/* whether a write of the given file is already pending */
+static bool write_pending(Array *pending, File *file) {
+	for (size_t i = 0, len = array_length(pending); i < len; i++) {
+		PendingWrite *w = array_get(pending, i);
+		if (w->win->file == file)
+			return true;
+	}
+	return false;
+}
+
 static bool cmd_files(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	bool ret = true;
+	/* writes of all files to their own names are committed together */
+	Array pending;
+	array_init_sized(&pending, sizeof(PendingWrite));
+	bool batch = cmd->cmd->cmddef->func == cmd_write && !cmd->cmd->argv[1];
 	for (Win *win = vis->windows; win; win = win->next) {
 		if (win->file->internal)
 			continue;
@@ -1569,9 +1651,22 @@ static bool cmd_files(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 		             (win->file->name && text_regex_match(cmd->regex, win->file->name, 0) == 0);
 		if (match ^ (argv[0][0] == 'Y')) {
 			Filerange def = text_range_new(0, 0);
-			ret &= sam_execute(vis, win, cmd->cmd, NULL, &def);
+			if (batch && win->file->name) {
+				/* a file displayed in multiple windows is only saved once,
+				 * concurrent saves of it would interfere with each other */
+				if (write_pending(&pending, win->file))
+					continue;
+				Command *c = cmd->cmd;
+				if (c->address)
+					def = address_evaluate(c->address, win->file, NULL, &def, 0);
+				ret &= write_files(vis, win, c, c->argv, &def, &pending);
+			} else {
+				ret &= sam_execute(vis, win, cmd->cmd, NULL, &def);
+			}
 		}
 	}
+	ret &= write_commit_all(vis, &pending);
+	array_release(&pending);
 	return ret;
 }
 
@@ -1580,11 +1675,156 @@ static bool cmd_substitute(Vis *vis, Win *win, Command *cmd, const char *argv[],
 	return false;
 }
 
-/* cmd_write stores win->file's contents end emits pre/post events.
+/* write_prepare checks whether win->file's contents may be stored at the
+ * given path and emits the pre event. If the range r covers the whole file,
+ * it is updated to account for potential file's text mutation by a
+ * FILE_SAVE_PRE callback.
+ */
+static bool write_prepare(Vis *vis, Win *win, Command *cmd, const char *name, Filerange *r,
+                          bool write_entire_file, PendingWrite *w) {
+	File *file = win->file;
+	*w = (PendingWrite){ .win = win };
+	if (!(w->path = absolute_path(name)))
+		return false;
+
+	struct stat meta;
+	w->existing_file = !stat(w->path, &meta);
+	w->same_file = w->existing_file && file->name &&
+	               file->stat.st_dev == meta.st_dev && file->stat.st_ino == meta.st_ino;
+
+	if (cmd->flags != '!') {
+		if (w->same_file && file->stat.st_mtime && file->stat.st_mtime < meta.st_mtime) {
+			vis_info_show(vis, "WARNING: file has been changed since reading it");
+			goto err;
+		}
+		if (w->existing_file && !w->same_file) {
+			vis_info_show(vis, "WARNING: file exists");
+			goto err;
+		}
+	}
+
+	if (!vis_event_emit(vis, VIS_EVENT_FILE_SAVE_PRE, file, w->path) && cmd->flags != '!') {
+		vis_info_show(vis, "Rejected write to `%s' by pre-save hook", w->path);
+		goto err;
+	}
+	/* a pre-save hook may have changed the text; need to re-take the range */
+	if (write_entire_file)
+		*r = text_range_new(0, text_size(file->text));
+	w->range = *r;
+	return true;
+err:
+	free(w->path);
+	return false;
+}
+
+/* write_start writes the previously prepared range or selections to disk */
+static bool write_start(Vis *vis, PendingWrite *w) {
+	File *file = w->win->file;
+	w->ctx = text_save_begin(file->text, AT_FDCWD, w->path, file->save_method);
+	if (!w->ctx) {
+		const char *msg = errno ? strerror(errno) : "try changing `:set savemethod`";
+		vis_info_show(vis, "Can't write `%s': %s", w->path, msg);
+		goto err;
+	}
+
+	bool visual = vis->mode->visual;
+
+	for (Selection *s = view_selections(w->win->view); s; s = view_selections_next(s)) {
+		Filerange range = visual ? view_selections_get(s) : w->range;
+		ssize_t written = text_save_write_range(w->ctx, &range);
+		if (written == -1 || (size_t)written != text_range_size(&range)) {
+			text_save_cancel(w->ctx);
+			w->ctx = NULL;
+			vis_info_show(vis, "Can't write `%s': %s", w->path, strerror(errno));
+			goto err;
+		}
+
+		if (!visual)
+			break;
+	}
+	return true;
+err:
+	free(w->path);
+	return false;
+}
+
+/* write_finish reports the result of the commit and emits the post event */
+static bool write_finish(Vis *vis, PendingWrite *w, bool committed, int error) {
+	File *file = w->win->file;
+	if (!committed) {
+		vis_info_show(vis, "Can't write `%s': %s", w->path, strerror(error));
+		free(w->path);
+		return false;
+	}
+
+	if (!file->name) {
+		file_name_set(file, w->path);
+		file_watch(vis, file);
+		w->same_file = true;
+	}
+	if (w->same_file || (!w->existing_file && strcmp(file->name, w->path) == 0)) {
+		file->stat = text_stat(file->text);
+		/* changes recorded so far are now on disk */
+		if (!vis->mode->visual && text_range_size(&w->range) == text_size(file->text)) {
+			file_journal_open(vis, file);
+			file_history_save(vis, file);
+		}
+	}
+	vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, w->path);
+	free(w->path);
+	return true;
+}
+
+/* commit all pending writes at once, see text_save_commit_all */
+static bool write_commit_all(Vis *vis, Array *pending) {
+	bool ret = true;
+	size_t count = array_length(pending);
+	if (count == 0)
+		return ret;
+	TextSave **ctx = calloc(count, sizeof *ctx);
+	int *errors = calloc(count, sizeof *errors);
+	if (!ctx || !errors) {
+		free(ctx);
+		free(errors);
+		ctx = NULL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		PendingWrite *w = array_get(pending, i);
+		if (!write_start(vis, w)) {
+			ret = false;
+			w->path = NULL;
+		} else if (!ctx) {
+			/* fall back to committing one after another */
+			bool committed = text_save_commit(w->ctx);
+			ret &= write_finish(vis, w, committed, errno);
+			w->path = NULL;
+		} else {
+			ctx[i] = w->ctx;
+		}
+	}
+
+	if (!ctx)
+		return ret;
+
+	text_save_commit_all(ctx, count, errors);
+	for (size_t i = 0; i < count; i++) {
+		PendingWrite *w = array_get(pending, i);
+		if (w->path)
+			ret &= write_finish(vis, w, errors[i] == 0, errors[i]);
+	}
+
+	free(ctx);
+	free(errors);
+	return ret;
+}
+
+/* write_files stores win->file's contents end emits pre/post events.
  * If the range r covers the whole file, it is updated to account for
- * potential file's text mutation by a FILE_SAVE_PRE callback.
+ * potential file's text mutation by a FILE_SAVE_PRE callback. If pending
+ * is given, writes to named files are only prepared and appended to it.
  */
-static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *r) {
+static bool write_files(Vis *vis, Win *win, Command *cmd, const char *argv[], Filerange *r, Array *pending) {
 	if (!win)
 		return false;
 
@@ -1648,80 +1888,29 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	}
 
 	for (const char **name = argv[1] ? &argv[1] : (const char*[]){ filename, NULL }; *name; name++) {
-
-		char *path = absolute_path(*name);
-		if (!path)
+		PendingWrite w;
+		if (!write_prepare(vis, win, cmd, *name, r, write_entire_file, &w))
 			return false;
-
-		struct stat meta;
-		bool existing_file = !stat(path, &meta);
-		bool same_file = existing_file && file->name &&
-		                 file->stat.st_dev == meta.st_dev && file->stat.st_ino == meta.st_ino;
-
-		if (cmd->flags != '!') {
-			if (same_file && file->stat.st_mtime && file->stat.st_mtime < meta.st_mtime) {
-				vis_info_show(vis, "WARNING: file has been changed since reading it");
-				goto err;
-			}
-			if (existing_file && !same_file) {
-				vis_info_show(vis, "WARNING: file exists");
-				goto err;
-			}
-		}
-
-		if (!vis_event_emit(vis, VIS_EVENT_FILE_SAVE_PRE, file, path) && cmd->flags != '!') {
-			vis_info_show(vis, "Rejected write to `%s' by pre-save hook", path);
-			goto err;
-		}
-		/* a pre-save hook may have changed the text; need to re-take the range */
-		if (write_entire_file)
-			*r = text_range_new(0, text_size(text));
-
-		TextSave *ctx = text_save_begin(text, AT_FDCWD, path, file->save_method);
-		if (!ctx) {
-			const char *msg = errno ? strerror(errno) : "try changing `:set savemethod`";
-			vis_info_show(vis, "Can't write `%s': %s", path, msg);
-			goto err;
-		}
-
-		bool failure = false;
-		bool visual = vis->mode->visual;
-
-		for (Selection *s = view_selections(win->view); s; s = view_selections_next(s)) {
-			Filerange range = visual ? view_selections_get(s) : *r;
-			ssize_t written = text_save_write_range(ctx, &range);
-			failure = (written == -1 || (size_t)written != text_range_size(&range));
-			if (failure) {
-				text_save_cancel(ctx);
-				break;
+		if (pending) {
+			if (!array_add(pending, &w)) {
+				free(w.path);
+				return false;
 			}
-
-			if (!visual)
-				break;
-		}
-
-		if (failure || !text_save_commit(ctx)) {
-			vis_info_show(vis, "Can't write `%s': %s", path, strerror(errno));
-			goto err;
-		}
-
-		if (!file->name) {
-			file_name_set(file, path);
-			same_file = true;
+			continue;
 		}
-		if (same_file || (!existing_file && strcmp(file->name, path) == 0))
-			file->stat = text_stat(text);
-		vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, path);
-		free(path);
-		continue;
-
-	err:
-		free(path);
-		return false;
+		if (!write_start(vis, &w))
+			return false;
+		bool committed = text_save_commit(w.ctx);
+		if (!write_finish(vis, &w, committed, errno))
+			return false;
 	}
 	return true;
 }
 
+static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *r) {
+	return write_files(vis, win, cmd, argv, r, NULL);
+}
+
 static ssize_t read_buffer(void *context, char *data, size_t len) {
 	buffer_append(context, data, len);
 	return len;
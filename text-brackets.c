@@ -0,0 +1,418 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "text.h"
+#include "text-internal.h"
+#include "util.h"
+
+/* The text is divided into blocks of BRACKET_BLOCK_SIZE bytes. For each of
+ * them the nesting depths at its start as well as their extrema within it
+ * are stored. Groups of BRACKET_FANOUT blocks are in turn summarized by
+ * nodes of the next level and so on, such that blocks in which a given
+ * depth is reached can be located in logarithmic time. Only the block
+ * containing the result, and the one holding the start position, need
+ * to be scanned.
+ *
+ * The index is built on demand starting from the beginning of the text,
+ * a modification discards all blocks from its position onwards.
+ */
+#define BRACKET_BLOCK_SIZE (1 << 13)
+#define BRACKET_FANOUT 32
+#define BRACKET_LEVELS 8
+
+/* Symbols tracked by the index. Opening brackets increment the depth of their
+ * kind, closing ones decrement it. Symbols without a counterpart only ever
+ * decrement it, such that consecutive occurrences can be located the same way. */
+enum {
+	KIND_PARENTHESIS = 1,
+	KIND_CURLY,
+	KIND_SQUARE,
+	KIND_ANGLE,
+	KIND_QUOTE,
+	KIND_BACKTICK,
+	KIND_DQUOTE,
+	KIND_NEWLINE,
+	KINDS = KIND_NEWLINE,
+	/* kinds which are also tracked separately for symbols preceded by an
+	 * even respectively odd number of double quotes */
+	KINDS_QUOTED = KIND_BACKTICK,
+	LISTS = KINDS + 2 * KINDS_QUOTED,
+};
+
+static const struct {
+	unsigned char kind;
+	signed char delta;
+} symbols[256] = {
+	['('] = { KIND_PARENTHESIS, +1 }, [')'] = { KIND_PARENTHESIS, -1 },
+	['{'] = { KIND_CURLY,       +1 }, ['}'] = { KIND_CURLY,       -1 },
+	['['] = { KIND_SQUARE,      +1 }, [']'] = { KIND_SQUARE,      -1 },
+	['<'] = { KIND_ANGLE,       +1 }, ['>'] = { KIND_ANGLE,       -1 },
+	['\''] = { KIND_QUOTE,      -1 },
+	['`']  = { KIND_BACKTICK,   -1 },
+	['"']  = { KIND_DQUOTE,     -1 },
+	['\n'] = { KIND_NEWLINE,    -1 },
+};
+
+typedef struct {
+	int64_t depth[LISTS];           /* depths at the start of the block */
+	int16_t min[LISTS], max[LISTS]; /* extrema after each of its bytes, relative to the former */
+} BracketBlock;
+
+typedef struct {
+	int64_t min[LISTS], max[LISTS]; /* extrema within all summarized blocks */
+} BracketNode;
+
+struct BracketIndex {
+	Array blocks;                   /* BracketBlock, consecutive starting from position zero */
+	Array levels[BRACKET_LEVELS];   /* BracketNode, each summarizing BRACKET_FANOUT entries of the level below */
+	int64_t depth[LISTS];           /* depths at the end of the indexed range */
+	size_t end;                     /* end of the indexed range, a multiple of the block size unless at EOF */
+};
+
+static int list(int kind, bool quoted, bool odd) {
+	if (!quoted || kind > KINDS_QUOTED)
+		return kind - 1;
+	return KINDS + 2 * (kind - 1) + odd;
+}
+
+static bool odd(const int64_t *depth) {
+	return depth[list(KIND_DQUOTE, false, false)] & 1;
+}
+
+BracketIndex *brackets_new(void) {
+	BracketIndex *idx = calloc(1, sizeof *idx);
+	if (!idx)
+		return NULL;
+	array_init_sized(&idx->blocks, sizeof(BracketBlock));
+	for (size_t i = 0; i < LENGTH(idx->levels); i++)
+		array_init_sized(&idx->levels[i], sizeof(BracketNode));
+	return idx;
+}
+
+void brackets_free(BracketIndex *idx) {
+	if (!idx)
+		return;
+	array_release(&idx->blocks);
+	for (size_t i = 0; i < LENGTH(idx->levels); i++)
+		array_release(&idx->levels[i]);
+	free(idx);
+}
+
+static size_t level_length(BracketIndex *idx, int level) {
+	return array_length(level ? &idx->levels[level-1] : &idx->blocks);
+}
+
+static void node_get(BracketIndex *idx, int level, size_t i, BracketNode *node) {
+	if (level) {
+		*node = *(BracketNode*)array_get(&idx->levels[level-1], i);
+		return;
+	}
+	BracketBlock *blk = array_get(&idx->blocks, i);
+	for (int l = 0; l < LISTS; l++) {
+		node->min[l] = blk->depth[l] + blk->min[l];
+		node->max[l] = blk->depth[l] + blk->max[l];
+	}
+}
+
+static void node_merge(BracketNode *node, const BracketNode *child) {
+	for (int l = 0; l < LISTS; l++) {
+		node->min[l] = MIN(node->min[l], child->min[l]);
+		node->max[l] = MAX(node->max[l], child->max[l]);
+	}
+}
+
+/* whether the depth of the list reaches target within the node */
+static bool node_reaches(BracketIndex *idx, int level, size_t i, int l, int64_t target, bool up) {
+	BracketNode node;
+	node_get(idx, level, i, &node);
+	return up ? node.max[l] >= target : node.min[l] <= target;
+}
+
+/* discard all but the first n blocks */
+static void index_truncate(BracketIndex *idx, size_t n) {
+	size_t len = array_length(&idx->blocks);
+	if (n >= len)
+		return;
+	BracketBlock *blk = array_get(&idx->blocks, n);
+	memcpy(idx->depth, blk->depth, sizeof idx->depth);
+	idx->end = n * BRACKET_BLOCK_SIZE;
+	array_truncate(&idx->blocks, n);
+	for (int level = 1; level <= BRACKET_LEVELS; level++) {
+		size_t children = level_length(idx, level-1);
+		size_t nodes = (children + BRACKET_FANOUT - 1) / BRACKET_FANOUT;
+		array_truncate(&idx->levels[level-1], nodes);
+		if (nodes == 0)
+			continue;
+		/* the last node might have summarized some of the discarded blocks */
+		BracketNode *node = array_get(&idx->levels[level-1], nodes-1), child;
+		for (size_t i = (nodes-1) * BRACKET_FANOUT; i < children; i++) {
+			node_get(idx, level-1, i, &child);
+			if (i % BRACKET_FANOUT == 0)
+				*node = child;
+			else
+				node_merge(node, &child);
+		}
+	}
+}
+
+static void index_reset(BracketIndex *idx) {
+	array_clear(&idx->blocks);
+	for (size_t i = 0; i < LENGTH(idx->levels); i++)
+		array_clear(&idx->levels[i]);
+	memset(idx->depth, 0, sizeof idx->depth);
+	idx->end = 0;
+}
+
+void brackets_invalidate(BracketIndex *idx, size_t pos) {
+	index_truncate(idx, pos / BRACKET_BLOCK_SIZE);
+}
+
+static bool index_append(BracketIndex *idx, const BracketBlock *blk) {
+	if (!array_add(&idx->blocks, (void*)blk))
+		return false;
+	size_t last = array_length(&idx->blocks) - 1;
+	BracketNode node;
+	node_get(idx, 0, last, &node);
+	for (int level = 1; level <= BRACKET_LEVELS; level++) {
+		Array *nodes = &idx->levels[level-1];
+		last /= BRACKET_FANOUT;
+		if (last < array_length(nodes)) {
+			node_merge(array_get(nodes, last), &node);
+		} else if (!array_add(nodes, &node)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* index the block following the currently indexed range */
+static bool index_extend(BracketIndex *idx, Text *txt) {
+	BracketBlock blk;
+	memcpy(blk.depth, idx->depth, sizeof blk.depth);
+	memset(blk.min, 0, sizeof blk.min);
+	memset(blk.max, 0, sizeof blk.max);
+	size_t pos = idx->end, end = MIN(text_size(txt), pos + BRACKET_BLOCK_SIZE);
+	bool quoted = odd(idx->depth);
+	for (Iterator it = text_iterator_get(txt, pos);
+	     pos < end && text_iterator_valid(&it);
+	     text_iterator_next(&it)) {
+		size_t len = MIN((size_t)(it.end - it.text), end - pos);
+		for (const char *s = it.text, *e = s + len; s < e; s++) {
+			int kind = symbols[(unsigned char)*s].kind;
+			if (!kind)
+				continue;
+			int delta = symbols[(unsigned char)*s].delta;
+			int lists[] = { list(kind, false, false), list(kind, true, quoted) };
+			for (size_t i = 0; i < LENGTH(lists); i++) {
+				int l = lists[i];
+				int16_t rel = (idx->depth[l] += delta) - blk.depth[l];
+				if (rel < blk.min[l])
+					blk.min[l] = rel;
+				if (rel > blk.max[l])
+					blk.max[l] = rel;
+				if (lists[1] == lists[0])
+					break;
+			}
+			if (kind == KIND_DQUOTE)
+				quoted = !quoted;
+		}
+		pos += len;
+	}
+	if (pos != end || !index_append(idx, &blk)) {
+		index_reset(idx);
+		return false;
+	}
+	idx->end = end;
+	return true;
+}
+
+/* make sure the index covers the range up to pos */
+static bool index_build(BracketIndex *idx, Text *txt, size_t pos) {
+	while (idx->end < pos) {
+		if (!index_extend(idx, txt))
+			return false;
+	}
+	return true;
+}
+
+/* depths at a block boundary within the indexed range */
+static const int64_t *index_depth(BracketIndex *idx, size_t pos) {
+	if (pos == idx->end)
+		return idx->depth;
+	if (pos % BRACKET_BLOCK_SIZE || pos > idx->end)
+		return NULL;
+	BracketBlock *blk = array_get(&idx->blocks, pos / BRACKET_BLOCK_SIZE);
+	return blk->depth;
+}
+
+/* first block at or after i in which the depth reaches target */
+static size_t index_find_next(BracketIndex *idx, size_t i, int l, int64_t target, bool up) {
+	int level = 0;
+	for (;;) {
+		size_t len = level_length(idx, level);
+		size_t group = MIN(len, (i / BRACKET_FANOUT + 1) * BRACKET_FANOUT);
+		if (level == BRACKET_LEVELS)
+			group = len;
+		for (; i < group; i++) {
+			if (node_reaches(idx, level, i, l, target, up))
+				goto found;
+		}
+		if (i == len)
+			return EPOS;
+		i /= BRACKET_FANOUT;
+		level++;
+	}
+found:
+	while (level-- > 0) {
+		for (i *= BRACKET_FANOUT; !node_reaches(idx, level, i, l, target, up); i++);
+	}
+	return i;
+}
+
+/* last block at or before i in which the depth reaches target */
+static size_t index_find_prev(BracketIndex *idx, size_t i, int l, int64_t target, bool up) {
+	int level = 0;
+	for (;;) {
+		size_t group = i / BRACKET_FANOUT * BRACKET_FANOUT;
+		if (level == BRACKET_LEVELS)
+			group = 0;
+		for (;; i--) {
+			if (node_reaches(idx, level, i, l, target, up))
+				goto found;
+			if (i == group)
+				break;
+		}
+		if (group == 0)
+			return EPOS;
+		i = group / BRACKET_FANOUT - 1;
+		level++;
+	}
+found:
+	while (level-- > 0) {
+		size_t len = level_length(idx, level);
+		for (i = MIN(len, (i+1) * BRACKET_FANOUT) - 1; !node_reaches(idx, level, i, l, target, up); i--);
+	}
+	return i;
+}
+
+/* Search state, the depth of the considered list as well as the parity of
+ * the number of double quotes are tracked relative to the start position,
+ * until a block boundary is reached from where on absolute values are used. */
+typedef struct {
+	int kind;          /* kind of symbol searched for */
+	bool quoted;       /* whether only symbols with the same parity are considered */
+	int64_t depth;     /* current depth */
+	int64_t target;    /* depth at which the search ends */
+	bool odd;          /* parity of double quotes at the current position */
+	bool parity;       /* parity of the considered symbols */
+} Search;
+
+static bool search_step(Search *s, char c, bool backward) {
+	if (backward && c == '"')
+		s->odd = !s->odd;
+	if (symbols[(unsigned char)c].kind == s->kind && (!s->quoted || s->odd == s->parity)) {
+		int delta = symbols[(unsigned char)c].delta;
+		s->depth += backward ? -delta : delta;
+		if (s->depth == s->target)
+			return true;
+	}
+	if (!backward && c == '"')
+		s->odd = !s->odd;
+	return false;
+}
+
+/* switch to the absolute depths at a block boundary */
+static int search_absolute(Search *s, const int64_t *depth) {
+	s->parity ^= s->odd ^ odd(depth);
+	s->odd = odd(depth);
+	int l = list(s->kind, s->quoted, s->parity);
+	s->target += depth[l] - s->depth;
+	s->depth = depth[l];
+	return l;
+}
+
+static void search_init(Search *s, char symbol, bool quoted, bool backward) {
+	s->kind = symbols[(unsigned char)symbol].kind;
+	s->quoted = quoted && s->kind <= KINDS_QUOTED;
+	s->depth = 0;
+	s->target = backward ? -symbols[(unsigned char)symbol].delta : symbols[(unsigned char)symbol].delta;
+	s->odd = s->parity = false;
+}
+
+size_t brackets_next(Text *txt, size_t pos, char close, bool quoted, size_t limit) {
+	size_t size = text_size(txt);
+	if (!symbols[(unsigned char)close].kind || pos >= size)
+		return EPOS;
+	BracketIndex *idx = text_brackets(txt);
+	/* searches within a limited range only build as much of the index
+	 * as they would otherwise have to scan */
+	if (idx && (limit == EPOS || idx->end >= pos))
+		index_build(idx, txt, MIN(limit, size));
+	if (limit > size)
+		limit = size;
+
+	Search s;
+	search_init(&s, close, quoted, false);
+	bool indexed = idx != NULL;
+	char c;
+	Iterator it = text_iterator_get(txt, pos);
+	while (pos < limit && text_iterator_byte_get(&it, &c)) {
+		const int64_t *depth = indexed && pos < idx->end ? index_depth(idx, pos) : NULL;
+		if (depth) {
+			/* skip blocks in which the target depth is not reached */
+			indexed = false;
+			int l = search_absolute(&s, depth);
+			size_t i = index_find_next(idx, pos / BRACKET_BLOCK_SIZE, l, s.target, s.target > s.depth);
+			pos = i == EPOS ? idx->end : i * BRACKET_BLOCK_SIZE;
+			depth = index_depth(idx, pos);
+			s.depth = depth[l];
+			s.odd = odd(depth);
+			it = text_iterator_get(txt, pos);
+			continue;
+		}
+		if (search_step(&s, c, false))
+			return pos;
+		text_iterator_byte_next(&it, NULL);
+		pos++;
+	}
+	return EPOS;
+}
+
+size_t brackets_prev(Text *txt, size_t pos, char open, bool quoted, size_t limit) {
+	if (!symbols[(unsigned char)open].kind || limit >= pos)
+		return EPOS;
+	size_t size = text_size(txt);
+	if (pos > size)
+		pos = size;
+	BracketIndex *idx = text_brackets(txt);
+	if (idx && idx->end >= limit)
+		index_build(idx, txt, pos);
+
+	Search s;
+	search_init(&s, open, quoted, true);
+	bool indexed = idx != NULL;
+	char c;
+	Iterator it = text_iterator_get(txt, pos);
+	while (pos > limit) {
+		const int64_t *depth = indexed ? index_depth(idx, pos) : NULL;
+		if (depth) {
+			indexed = false;
+			int l = search_absolute(&s, depth);
+			size_t i = index_find_prev(idx, (pos - 1) / BRACKET_BLOCK_SIZE, l, s.target, s.target > s.depth);
+			if (i == EPOS)
+				return s.target == 0 && limit == 0 ? 0 : EPOS;
+			pos = MIN((i + 1) * BRACKET_BLOCK_SIZE, idx->end);
+			depth = index_depth(idx, pos);
+			s.depth = depth[l];
+			s.odd = odd(depth);
+			it = text_iterator_get(txt, pos);
+			continue;
+		}
+		if (!text_iterator_byte_prev(&it, &c))
+			break;
+		pos--;
+		if (search_step(&s, c, true))
+			return pos;
+	}
+	return EPOS;
+}
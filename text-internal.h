@@ -4,9 +4,10 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "text.h"
+#include "array.h"
 
 /* Block holding the file content, either readonly mmap(2)-ed from the original
- * file or heap allocated to store the modifications.
+ * file or anonymously mapped to store the modifications.
  */
 typedef struct {
 	size_t size;               /* maximal capacity */
@@ -15,21 +16,104 @@ typedef struct {
 	enum {                     /* type of allocation */
 		BLOCK_TYPE_MMAP_ORIG, /* mmap(2)-ed from an external file */
 		BLOCK_TYPE_MMAP,      /* mmap(2)-ed from a temporary file only known to this process */
-		BLOCK_TYPE_MALLOC,    /* heap allocated block using malloc(3) */
+		BLOCK_TYPE_ANON,      /* anonymous mmap(2)-ed memory, parts might be paged out */
 	} type;
+	size_t refs;               /* number of additional owners, see block_ref */
 } Block;
 
 Block *block_alloc(size_t size);
 Block *block_read(size_t size, int fd);
 Block *block_mmap(size_t size, int fd, off_t offset);
 Block *block_load(int dirfd, const char *filename, enum TextLoadMethod method, struct stat *info);
+/* Share the block, it is only freed once every owner called block_free. */
+Block *block_ref(Block*);
 void block_free(Block*);
+/* Release the memory of an unused block, but keep its address range reserved
+ * such that stale marks never refer to data which is allocated later. */
+bool block_retire(Block*);
 bool block_capacity(Block*, size_t len);
 const char *block_append(Block*, const char *data, size_t len);
 bool block_insert(Block*, size_t pos, const char *data, size_t len);
 bool block_delete(Block*, size_t pos, size_t len);
 
+/* Replace the pages of a block mmap(2)-ed from the original file which overlap
+ * one of the given sorted ranges (as Filerange relative to its data) by a
+ * private copy. */
+bool block_detach(Block*, const Array *ranges);
+/* Write the page aligned range [start, end) of an anonymous block to fd at
+ * offset and map it from there, releasing the memory it occupied. */
+bool block_page(Block*, size_t start, size_t end, int fd, off_t offset);
+
 Block *text_block_mmaped(Text*);
-void text_saved(Text*, struct stat *meta);
+/* Replace len bytes at pos by the content of the given block (if any). The
+ * block is not copied, the text takes ownership of it. */
+bool text_replace_block(Text*, size_t pos, size_t len, Block*);
+void text_saved(Text*, struct stat *meta, bool complete);
+/* Store the ranges (as Filerange) in which the current content differs from
+ * the file content at load or last complete save time. Fails if the latter
+ * is unknown or more than limit bytes would need to be written. */
+bool text_saved_ranges(Text*, Array *ranges, size_t *saved_size, size_t limit);
+/* Look up where the given piece data is stored in the file at load or last
+ * complete save time. Returns the length of the prefix of [data, data+len)
+ * which is either stored contiguously starting from offset, or not part of
+ * the file at all in which case offset is set to -1. */
+size_t text_saved_offset(Text*, const char *data, size_t len, off_t *offset);
+
+/* Append only log of modifications used for crash recovery, see text_journal_open */
+typedef struct Journal Journal;
+
+/* Create a new journal for changes to the file content described by base,
+ * fails with EEXIST if the journal already exists. */
+Journal *journal_open(const char *filename, const struct stat *base);
+/* Apply all changes of an existing journal up to its last checkpoint, the
+ * returned journal is truncated accordingly and ready to record new ones. */
+Journal *journal_recover(Text*, const char *filename);
+/* Discard all recorded changes, subsequent ones apply to the content described by base. */
+bool journal_restart(Journal*, const struct stat *base);
+/* Record the deletion of del bytes at pos followed by an insertion of data. */
+void journal_change(Journal*, size_t pos, size_t del, const char *data, size_t len);
+/* Whether changes were recorded since the last checkpoint. */
+bool journal_pending(const Journal*);
+/* Write all recorded changes followed by a checkpoint and sync them to disk. */
+bool journal_checkpoint(Journal*, size_t size);
+void journal_free(Journal*, bool remove);
+
+/* Nesting depths of brackets and quotes, see text-brackets.c */
+typedef struct BracketIndex BracketIndex;
+
+BracketIndex *brackets_new(void);
+/* Discard everything depending on the content from pos onwards. */
+void brackets_invalidate(BracketIndex*, size_t pos);
+void brackets_free(BracketIndex*);
+/* The index of the given text, allocated on first use. */
+BracketIndex *text_brackets(Text*);
+/* Position of the first close symbol at or after pos which is not matched by
+ * an opening one in between, EPOS if there is none before limit. For symbols
+ * without a counterpart (quotes, newline) this is their next occurrence. If
+ * quoted is set, only symbols preceded by as many double quotes as pos
+ * (modulo two) are considered. */
+size_t brackets_next(Text*, size_t pos, char close, bool quoted, size_t limit);
+/* Same for the last opening symbol before pos, at or after limit. */
+size_t brackets_prev(Text*, size_t pos, char open, bool quoted, size_t limit);
+
+/* Character counts and display widths within long lines, see text-motions.c */
+typedef struct ColumnCache ColumnCache;
+
+ColumnCache *columns_new(void);
+/* Discard everything depending on the content from pos onwards. */
+void columns_invalidate(ColumnCache*, size_t pos);
+void columns_free(ColumnCache*);
+/* The cache of the given text, allocated on first use. */
+ColumnCache *text_columns(Text*);
+
+/* Distinct words and their number of occurrences, see text-words.c */
+typedef struct WordIndex WordIndex;
+
+WordIndex *words_new(void);
+/* Account for the replacement of del bytes at pos by len new ones. */
+void words_change(WordIndex*, size_t pos, size_t del, size_t len);
+void words_free(WordIndex*);
+/* The index of the given text, allocated on first use. */
+WordIndex *text_words_index(Text*);
 
 #endif
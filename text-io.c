@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* copy_file_range(2) is non-standard */
+#endif
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -6,7 +9,14 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#if HAVE_FICLONERANGE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #if CONFIG_ACL
 #include <sys/acl.h>
 #endif
@@ -17,15 +27,25 @@
 #include "text.h"
 #include "text-internal.h"
 #include "text-util.h"
+#include "buffer.h"
 #include "util.h"
 
 struct TextSave {                  /* used to hold context between text_save_{begin,commit} calls */
 	Text *txt;                 /* text to operate on */
 	char *filename;            /* filename to save to as given to text_save_begin */
 	char *tmpname;             /* temporary name used for atomic rename(2) */
+	char *journal;             /* name of the journal of an incremental save */
 	int fd;                    /* file descriptor to write data to using text_save_write */
 	int dirfd;                 /* directory file descriptor, relative to which we save */
 	enum TextSaveMethod type;  /* method used to save file */
+	bool written;              /* whether text_save_write_range was called */
+	bool complete;             /* whether the whole text was written in one go */
+	Array ranges;              /* modified file regions to update during an incremental save */
+	size_t saved_size;         /* file size before an incremental save */
+	struct timespec stamp;     /* modification time of the file during an incremental save */
+	int srcfd;                 /* unmodified original file, source of in kernel copies */
+	blksize_t blksize;         /* block size of the file system we are writing to */
+	struct stat meta;          /* file information after the content was flushed to disk */
 };
 
 /* Allocate blocks holding the actual file content in chunks of size: */
@@ -36,6 +56,9 @@ struct TextSave {                  /* used to hold context between text_save_{be
  * directely. Hence the former can be truncated, while doing so on the latter
  * results in havoc. */
 #define BLOCK_MMAP_SIZE (1 << 26)
+/* When reloading a file whose modified part kept its size, the content is
+ * compared in blocks of this size and only differing ones are replaced. */
+#define RELOAD_BLOCK_SIZE (1 << 12)
 
 /* allocate a new block of MAX(size, BLOCK_SIZE) bytes */
 Block *block_alloc(size_t size) {
@@ -44,11 +67,12 @@ Block *block_alloc(size_t size) {
 		return NULL;
 	if (BLOCK_SIZE > size)
 		size = BLOCK_SIZE;
-	if (!(blk->data = malloc(size))) {
+	blk->data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (blk->data == MAP_FAILED) {
 		free(blk);
 		return NULL;
 	}
-	blk->type = BLOCK_TYPE_MALLOC;
+	blk->type = BLOCK_TYPE_ANON;
 	blk->size = size;
 	return blk;
 }
@@ -118,16 +142,30 @@ out:
 	return block;
 }
 
+Block *block_ref(Block *blk) {
+	blk->refs++;
+	return blk;
+}
+
 void block_free(Block *blk) {
 	if (!blk)
 		return;
-	if (blk->type == BLOCK_TYPE_MALLOC)
-		free(blk->data);
-	else if ((blk->type == BLOCK_TYPE_MMAP_ORIG || blk->type == BLOCK_TYPE_MMAP) && blk->data)
+	if (blk->refs > 0) {
+		blk->refs--;
+		return;
+	}
+	if (blk->data)
 		munmap(blk->data, blk->size);
 	free(blk);
 }
 
+bool block_retire(Block *blk) {
+	if (mmap(blk->data, blk->size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED)
+		return false;
+	blk->len = 0;
+	return true;
+}
+
 /* check whether block has enough free space to store len bytes */
 bool block_capacity(Block *blk, size_t len) {
 	return blk->size - blk->len >= len;
@@ -199,6 +237,280 @@ static ssize_t write_all(int fd, const char *buf, size_t count) {
 	return count - rem;
 }
 
+static ssize_t pwrite_all(int fd, const char *buf, size_t count, off_t offset) {
+	size_t rem = count;
+	while (rem > 0) {
+		ssize_t written = pwrite(fd, buf, rem > INT_MAX ? INT_MAX : rem, offset);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		} else if (written == 0) {
+			break;
+		}
+		rem -= written;
+		buf += written;
+		offset += written;
+	}
+	return count - rem;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 16 /* _XOPEN_IOV_MAX */
+#endif
+/* number of chunks passed to a single writev(2) call */
+#define WRITE_IOV_MAX (IOV_MAX < 1024 ? IOV_MAX : 1024)
+
+/* Write all chunks described by iov, at the given file offset unless it is
+ * negative. The vector is modified in the process. */
+static ssize_t writev_all(int fd, struct iovec *iov, int count, off_t offset) {
+	ssize_t total = 0;
+	while (count > 0) {
+		ssize_t written;
+		if (offset < 0)
+			written = writev(fd, iov, count);
+		else
+#if HAVE_PWRITEV
+			written = pwritev(fd, iov, count, offset + total);
+#else
+			written = pwrite(fd, iov->iov_base, iov->iov_len, offset + total);
+#endif
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		} else if (written == 0) {
+			break;
+		}
+		total += written;
+		for (; count > 0 && (size_t)written >= iov->iov_len; iov++, count--)
+			written -= iov->iov_len;
+		if (count > 0) {
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return total;
+}
+
+/* Describe at most count chunks of the following *rem bytes, starting at the
+ * iterator position, which is advanced past them. */
+static size_t iterator_iovec(Iterator *it, size_t *rem, struct iovec *iov, size_t count) {
+	size_t n = 0;
+	while (n < count && *rem > 0 && text_iterator_valid(it)) {
+		size_t len = MIN((size_t)(it->end - it->text), *rem);
+		if (len > 0) {
+			iov[n].iov_base = (char*)it->text;
+			iov[n++].iov_len = len;
+			*rem -= len;
+		}
+		if (len < (size_t)(it->end - it->text)) {
+			it->text += len;
+			it->pos += len;
+		} else if (!text_iterator_next(it)) {
+			break;
+		}
+	}
+	return n;
+}
+
+/* Write a file range using as few system calls as possible, either
+ * sequentially or to the same offset of the file. */
+static ssize_t text_writev_range(const Text *txt, const Filerange *range, int fd, bool positional) {
+	struct iovec iov[WRITE_IOV_MAX];
+	size_t size = text_range_size(range), rem = size;
+	Iterator it = text_iterator_get(txt, range->start);
+	while (rem > 0) {
+		size_t len = MIN(rem, (size_t)SSIZE_MAX), left = len;
+		size_t count = iterator_iovec(&it, &left, iov, LENGTH(iov));
+		if (count == 0)
+			break;
+		len -= left;
+		off_t offset = positional ? (off_t)(range->start + size - rem) : -1;
+		ssize_t written = writev_all(fd, iov, count, offset);
+		if (written == -1)
+			return -1;
+		rem -= written;
+		if ((size_t)written != len)
+			break;
+	}
+	return size - rem;
+}
+
+static ssize_t pread_all(int fd, char *buf, size_t count, off_t offset) {
+	size_t rem = count;
+	while (rem > 0) {
+		ssize_t len = pread(fd, buf, rem > INT_MAX ? INT_MAX : rem, offset);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		} else if (len == 0) {
+			break;
+		}
+		rem -= len;
+		buf += len;
+		offset += len;
+	}
+	return count - rem;
+}
+
+/* write file range to the same offset of the given file descriptor */
+static ssize_t text_pwrite_range(const Text *txt, const Filerange *range, int fd) {
+	return text_writev_range(txt, range, fd, true);
+}
+
+/* Compare text and file content starting at the given positions, or ending
+ * at them if backward is set. Returns the length of the common part which
+ * is at most max bytes long or -1 in case of an error. */
+static ssize_t reload_common(Text *txt, size_t pos, int fd, off_t offset, size_t max, bool backward) {
+	char *fbuf = malloc(BLOCK_SIZE), *tbuf = malloc(BLOCK_SIZE);
+	ssize_t common = -1;
+	if (!fbuf || !tbuf)
+		goto out;
+	size_t len = 0;
+	for (common = 0; (size_t)common < max; common += len) {
+		len = MIN(max - common, BLOCK_SIZE);
+		size_t tpos = backward ? pos - (size_t)common - len : pos + (size_t)common;
+		off_t foff = backward ? offset - common - (off_t)len : offset + common;
+		if (pread_all(fd, fbuf, len, foff) != (ssize_t)len ||
+		    text_bytes_get(txt, tpos, len, tbuf) != len) {
+			common = -1;
+			goto out;
+		}
+		if (memcmp(fbuf, tbuf, len) == 0)
+			continue;
+		size_t i = 0;
+		if (backward) {
+			while (fbuf[len-1-i] == tbuf[len-1-i])
+				i++;
+		} else {
+			while (fbuf[i] == tbuf[i])
+				i++;
+		}
+		common += i;
+		break;
+	}
+out:
+	free(fbuf);
+	free(tbuf);
+	return common;
+}
+
+/* Append the regions in which the text and file content of len bytes starting
+ * at pos differ to the given array. Both are compared in blocks, regions which
+ * are separated by at least one identical block are reported separately. */
+static bool reload_regions(Text *txt, size_t pos, int fd, size_t len, Array *regions) {
+	char *fbuf = malloc(BLOCK_SIZE), *tbuf = malloc(BLOCK_SIZE);
+	Filerange r = text_range_empty();
+	bool ret = fbuf && tbuf;
+	for (size_t off = 0; ret && off < len; off += BLOCK_SIZE) {
+		size_t n = MIN(len - off, BLOCK_SIZE);
+		if (pread_all(fd, fbuf, n, pos + off) != (ssize_t)n ||
+		    text_bytes_get(txt, pos + off, n, tbuf) != n) {
+			ret = false;
+			break;
+		}
+		for (size_t i = 0; ret && i < n; i += RELOAD_BLOCK_SIZE) {
+			const char *f = fbuf + i, *t = tbuf + i;
+			size_t start = 0, end = MIN(n - i, RELOAD_BLOCK_SIZE);
+			if (memcmp(f, t, end) == 0) {
+				if (text_range_valid(&r))
+					ret = array_add(regions, &r);
+				r = text_range_empty();
+				continue;
+			}
+			while (f[start] == t[start])
+				start++;
+			while (f[end-1] == t[end-1])
+				end--;
+			if (!text_range_valid(&r))
+				r.start = pos + off + i + start;
+			r.end = pos + off + i + end;
+		}
+	}
+	if (ret && text_range_valid(&r))
+		ret = array_add(regions, &r);
+	free(fbuf);
+	free(tbuf);
+	return ret;
+}
+
+/* replace del bytes at pos by len bytes read from the same file offset */
+static bool reload_replace(Text *txt, int fd, size_t pos, size_t del, size_t len) {
+	Block *block = NULL;
+	if (len > 0) {
+		if (lseek(fd, pos, SEEK_SET) == -1 || !(block = block_read(len, fd)))
+			return false;
+		if (block->len != len) {
+			block_free(block);
+			errno = EIO;
+			return false;
+		}
+	}
+	return text_replace_block(txt, pos, del, block);
+}
+
+/* The common prefix and suffix of the text and the file content are kept,
+ * hence appending to a file only reads and compares the existing content.
+ * If the part in between did not change size, only the blocks within it
+ * which differ are replaced. Otherwise offsets do not line up and it is
+ * replaced as a whole. */
+bool text_reload(Text *txt, const char *filename) {
+	bool ret = false;
+	struct stat info, loaded = text_stat(txt);
+	Array regions;
+	array_init_sized(&regions, sizeof(Filerange));
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &info) == -1)
+		goto out;
+	if (!S_ISREG(info.st_mode)) {
+		errno = S_ISDIR(info.st_mode) ? EISDIR : ENOTSUP;
+		goto out;
+	}
+
+	size_t size = info.st_size, tsize = text_size(txt);
+	bool same = info.st_dev == loaded.st_dev && info.st_ino == loaded.st_ino;
+	Block *mmaped = text_block_mmaped(txt);
+	if (same && mmaped && size < mmaped->size) {
+		/* accessing the truncated part of the mapping would raise SIGBUS */
+		errno = ENOTSUP;
+		goto out;
+	}
+
+	ssize_t prefix, suffix;
+	size_t max = MIN(size, tsize);
+	if ((prefix = reload_common(txt, 0, fd, 0, max, false)) == -1)
+		goto out;
+	if ((suffix = reload_common(txt, tsize, fd, size, max - prefix, true)) == -1)
+		goto out;
+
+	size_t del = tsize - prefix - suffix, len = size - prefix - suffix;
+	if (del == len && !reload_regions(txt, prefix, fd, len, &regions))
+		goto out;
+	/* all replacements form a single revision */
+	text_snapshot(txt);
+	if (del != len) {
+		if (!reload_replace(txt, fd, prefix, del, len))
+			goto out;
+	} else {
+		for (size_t i = 0, count = array_length(&regions); i < count; i++) {
+			Filerange *r = array_get(&regions, i);
+			size_t n = text_range_size(r);
+			if (!reload_replace(txt, fd, r->start, n, n))
+				goto out;
+		}
+	}
+	text_saved(txt, &info, true);
+	ret = true;
+out:
+	array_release(&regions);
+	close(fd);
+	return ret;
+}
+
 static bool preserve_acl(int src, int dest) {
 #if CONFIG_ACL
 	acl_t acl = acl_get_fd(src);
@@ -248,6 +560,53 @@ err:
 	return fd;
 }
 
+typedef struct {                   /* directory synced by text_save_commit_all */
+	dev_t dev;
+	ino_t ino;
+	int error;                 /* errno value of a failed sync, zero otherwise */
+} SyncedDir;
+
+/* open the directory containing the file being saved */
+static int dir_open(TextSave *ctx) {
+	char *name = strdup(ctx->filename);
+	if (!name)
+		return -1;
+	int dir = openat(ctx->dirfd, dirname(name), O_DIRECTORY|O_RDONLY);
+	free(name);
+	return dir;
+}
+
+/* flush directory entries to disk and close the directory */
+static bool dir_sync(int dir) {
+	if (fsync(dir) == -1 && errno != EINVAL) {
+		close(dir);
+		return false;
+	}
+	return close(dir) == 0;
+}
+
+/* Create a new file named `.filename.vis.XXXXXX` (where `XXXXXX` is a
+ * randomly generated, unique suffix) in the same directory as the file
+ * being saved, its name is stored in ctx->tmpname. */
+static int mkstemp_sibling(TextSave *ctx) {
+	char suffix[] = ".vis.XXXXXX";
+	size_t len = strlen(ctx->filename) + sizeof("./.") + sizeof(suffix);
+	char *dir = strdup(ctx->filename);
+	char *base = strdup(ctx->filename);
+
+	if (!(ctx->tmpname = malloc(len)) || !dir || !base) {
+		free(dir);
+		free(base);
+		return -1;
+	}
+
+	snprintf(ctx->tmpname, len, "%s/.%s%s", dirname(dir), basename(base), suffix);
+	free(dir);
+	free(base);
+
+	return mkstempat(ctx->dirfd, ctx->tmpname);
+}
+
 /* Create a new file named `.filename.vis.XXXXXX` (where `XXXXXX` is a
  * randomly generated, unique suffix) and try to preserve all important
  * meta data. After the file content has been written to this temporary
@@ -278,22 +637,7 @@ static bool text_save_begin_atomic(TextSave *ctx) {
 			goto err;
 	}
 
-	char suffix[] = ".vis.XXXXXX";
-	size_t len = strlen(ctx->filename) + sizeof("./.") + sizeof(suffix);
-	char *dir = strdup(ctx->filename);
-	char *base = strdup(ctx->filename);
-
-	if (!(ctx->tmpname = malloc(len)) || !dir || !base) {
-		free(dir);
-		free(base);
-		goto err;
-	}
-
-	snprintf(ctx->tmpname, len, "%s/.%s%s", dirname(dir), basename(base), suffix);
-	free(dir);
-	free(base);
-
-	if ((ctx->fd = mkstempat(ctx->dirfd, ctx->tmpname)) == -1)
+	if ((ctx->fd = mkstemp_sibling(ctx)) == -1)
 		goto err;
 
 	if (oldfd == -1) {
@@ -313,7 +657,20 @@ static bool text_save_begin_atomic(TextSave *ctx) {
 		 * the group permissions to the same as for others */
 		if (oldmeta.st_gid != getgid() && fchown(ctx->fd, (uid_t)-1, oldmeta.st_gid) == -1)
 			goto err;
-		close(oldfd);
+#if HAVE_COPY_FILE_RANGE || HAVE_FICLONERANGE
+		/* keep the file open if it still holds the content we know about,
+		 * unmodified parts can then be copied without going through user space */
+		struct stat loaded = text_stat(ctx->txt), tmpmeta;
+		if (oldmeta.st_dev == loaded.st_dev && oldmeta.st_ino == loaded.st_ino &&
+		    oldmeta.st_size == loaded.st_size && stat_mtime_equal(&oldmeta, &loaded) &&
+		    fstat(ctx->fd, &tmpmeta) == 0) {
+			ctx->srcfd = oldfd;
+			ctx->blksize = tmpmeta.st_blksize;
+			oldfd = -1;
+		}
+#endif
+		if (oldfd != -1)
+			close(oldfd);
 	}
 
 	ctx->type = TEXT_SAVE_ATOMIC;
@@ -331,12 +688,11 @@ err:
 	return false;
 }
 
-static bool text_save_commit_atomic(TextSave *ctx) {
+static bool text_save_flush_atomic(TextSave *ctx) {
 	if (fsync(ctx->fd) == -1)
 		return false;
 
-	struct stat meta = { 0 };
-	if (fstat(ctx->fd, &meta) == -1)
+	if (fstat(ctx->fd, &ctx->meta) == -1)
 		return false;
 
 	bool close_failed = (close(ctx->fd) == -1);
@@ -349,20 +705,6 @@ static bool text_save_commit_atomic(TextSave *ctx) {
 
 	free(ctx->tmpname);
 	ctx->tmpname = NULL;
-
-	int dir = openat(ctx->dirfd, dirname(ctx->filename), O_DIRECTORY|O_RDONLY);
-	if (dir == -1)
-		return false;
-
-	if (fsync(dir) == -1 && errno != EINVAL) {
-		close(dir);
-		return false;
-	}
-
-	if (close(dir) == -1)
-		return false;
-
-	text_saved(ctx->txt, &meta);
 	return true;
 }
 
@@ -418,16 +760,417 @@ err:
 	return false;
 }
 
-static bool text_save_commit_inplace(TextSave *ctx) {
+static bool text_save_flush_inplace(TextSave *ctx) {
 	if (fsync(ctx->fd) == -1)
 		return false;
-	struct stat meta = { 0 };
-	if (fstat(ctx->fd, &meta) == -1)
-		return false;
-	if (close(ctx->fd) == -1)
+	if (fstat(ctx->fd, &ctx->meta) == -1)
 		return false;
-	text_saved(ctx->txt, &meta);
+	bool close_failed = (close(ctx->fd) == -1);
+	ctx->fd = -1;
+	return !close_failed;
+}
+
+/* name of the journal of an incremental save, `.filename.vis.save` */
+static char *journal_name(const char *filename) {
+	char *dir = strdup(filename);
+	char *base = strdup(filename);
+	char *name = NULL;
+	if (dir && base) {
+		size_t len = strlen(filename) + sizeof("./..vis.save");
+		if ((name = malloc(len)))
+			snprintf(name, len, "%s/.%s.vis.save", dirname(dir), basename(base));
+	}
+	free(dir);
+	free(base);
+	return name;
+}
+
+/* Incremental saves compare the current piece chain against the one which
+ * was written to (or loaded from) disk most recently and only pwrite(2) the
+ * modified regions. This is only attempted if the file is still the one we
+ * know about (same inode, size and modification time) and the total amount
+ * of modified data is less than half of the file size. Otherwise we fall
+ * back to an atomic save.
+ *
+ * Before touching the file, the previous content of all regions which are
+ * about to be overwritten is stored in a journal named `.filename.vis.save`
+ * and flushed to disk. It is written to a temporary file first and renamed
+ * into place once complete. If a write fails, the file is restored from it.
+ * The journal is only removed once the new content has been synced, hence if
+ * we crash in between the incomplete save can be rolled back on request by
+ * means of text_save_rollback.
+ *
+ * While the save is in progress the file has its final size and, after every
+ * write, a modification time chosen upfront. Both are recorded in the journal
+ * such that it is never applied to a file which was modified afterwards. The
+ * journal has the following format, all integers are stored in native byte
+ * order:
+ *
+ *   uint64_t dev, ino                     identity of the file
+ *   uint64_t size                         original file size
+ *   int64_t mtime, mtime_nsec             original modification time
+ *   uint64_t new_size                     file size during the save
+ *   int64_t new_mtime, new_mtime_nsec     modification time during the save
+ *   { uint64_t offset, uint64_t len,      previous content of a region
+ *     char data[len] }*
+ */
+static bool text_save_begin_incremental(TextSave *ctx) {
+	Text *txt = ctx->txt;
+	struct stat now = { 0 }, loaded = text_stat(txt);
+	int saved_errno;
+	if ((ctx->fd = openat(ctx->dirfd, ctx->filename, O_RDWR)) == -1)
+		goto err;
+	if (fstat(ctx->fd, &now) == -1)
+		goto err;
+	if (!S_ISREG(now.st_mode) || now.st_dev != loaded.st_dev || now.st_ino != loaded.st_ino ||
+	    now.st_size != loaded.st_size || !stat_mtime_equal(&now, &loaded))
+		goto err;
+	if (!text_saved_ranges(txt, &ctx->ranges, &ctx->saved_size, text_size(txt) / 2))
+		goto err;
+	if (ctx->saved_size != (size_t)now.st_size)
+		goto err;
+	/* a journal which could not be rolled back is kept for manual recovery */
+	if (!(ctx->journal = journal_name(ctx->filename)))
+		goto err;
+	if (faccessat(ctx->dirfd, ctx->journal, F_OK, 0) == 0) {
+		errno = EEXIST;
+		goto err;
+	}
+	if (clock_gettime(CLOCK_REALTIME, &ctx->stamp) == -1)
+		goto err;
+	ctx->meta = now;
+	ctx->type = TEXT_SAVE_INCREMENTAL;
 	return true;
+err:
+	saved_errno = errno;
+	if (ctx->fd != -1)
+		close(ctx->fd);
+	ctx->fd = -1;
+	free(ctx->journal);
+	ctx->journal = NULL;
+	errno = saved_errno;
+	return false;
+}
+
+static bool journal_write_u64(int journal, uint64_t value) {
+	return write_all(journal, (const char*)&value, sizeof value) == sizeof value;
+}
+
+static bool journal_read_u64(int journal, uint64_t *value) {
+	ssize_t len = read(journal, value, sizeof *value);
+	return len == sizeof *value;
+}
+
+/* store previous content of all regions which will be overwritten */
+static bool journal_write(TextSave *ctx) {
+	char buf[BUFSIZ];
+	int journal = mkstemp_sibling(ctx);
+	if (journal == -1)
+		return false;
+	/* the journal resides on the same file system, thus its modification
+	 * time is stored with the same granularity as the one of the file */
+	struct stat touched;
+	struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, ctx->stamp };
+	size_t size = text_size(ctx->txt), count = array_length(&ctx->ranges);
+	bool ret = futimens(journal, times) == 0 && fstat(journal, &touched) == 0 &&
+	           journal_write_u64(journal, ctx->meta.st_dev) &&
+	           journal_write_u64(journal, ctx->meta.st_ino) &&
+	           journal_write_u64(journal, ctx->saved_size) &&
+	           journal_write_u64(journal, ctx->meta.st_mtime) &&
+	           journal_write_u64(journal, stat_mtime_nsec(&ctx->meta)) &&
+	           journal_write_u64(journal, size) &&
+	           journal_write_u64(journal, touched.st_mtime) &&
+	           journal_write_u64(journal, stat_mtime_nsec(&touched));
+	/* also preserve the tail of the file which is about to be truncated */
+	Filerange truncated = { .start = size, .end = ctx->saved_size };
+	for (size_t i = 0; ret && i <= count; i++) {
+		Filerange *r = i < count ? array_get(&ctx->ranges, i) : &truncated;
+		if (r->start >= MIN(r->end, ctx->saved_size))
+			continue;
+		size_t off = r->start, rem = MIN(r->end, ctx->saved_size) - r->start;
+		ret = journal_write_u64(journal, off) && journal_write_u64(journal, rem);
+		while (ret && rem > 0) {
+			size_t n = MIN(rem, sizeof buf);
+			ret = pread_all(ctx->fd, buf, n, off) == (ssize_t)n &&
+			      write_all(journal, buf, n) == (ssize_t)n;
+			off += n;
+			rem -= n;
+		}
+	}
+
+	if (ret)
+		ret = fsync(journal) == 0;
+	if (close(journal) == -1)
+		ret = false;
+	/* only a complete journal is ever found under its final name */
+	if (!ret || renameat(ctx->dirfd, ctx->tmpname, ctx->dirfd, ctx->journal) == -1)
+		return false;
+	free(ctx->tmpname);
+	ctx->tmpname = NULL;
+
+	/* make sure the journal can be found after a crash */
+	int dir = dir_open(ctx);
+	return dir != -1 && dir_sync(dir);
+}
+
+/* set the modification time of the file being saved incrementally to the
+ * one recorded in the journal */
+static bool journal_touch(TextSave *ctx) {
+	struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, ctx->stamp };
+	return futimens(ctx->fd, times) == 0;
+}
+
+/* Restore previous content and modification time of the file as recorded in
+ * the journal. Unless the file is known to be in the state left behind by the
+ * save, fails with ESTALE if the journal belongs to a different file or the
+ * file was modified since. */
+static bool journal_apply(int fd, int journal, bool check) {
+	char buf[BUFSIZ];
+	uint64_t dev, ino, size, mtime, mtime_nsec, new_size, new_mtime, new_mtime_nsec, off, len;
+	struct stat meta;
+	if (fstat(fd, &meta) == -1)
+		return false;
+	if (!journal_read_u64(journal, &dev) || !journal_read_u64(journal, &ino) ||
+	    !journal_read_u64(journal, &size) || !journal_read_u64(journal, &mtime) ||
+	    !journal_read_u64(journal, &mtime_nsec) || !journal_read_u64(journal, &new_size) ||
+	    !journal_read_u64(journal, &new_mtime) || !journal_read_u64(journal, &new_mtime_nsec)) {
+		errno = EINVAL;
+		return false;
+	}
+	if (check && (dev != (uint64_t)meta.st_dev || ino != (uint64_t)meta.st_ino ||
+	    new_size != (uint64_t)meta.st_size || (int64_t)new_mtime != (int64_t)meta.st_mtime ||
+	    (int64_t)new_mtime_nsec != (int64_t)stat_mtime_nsec(&meta))) {
+		errno = ESTALE;
+		return false;
+	}
+	bool ret = true;
+	while (ret && journal_read_u64(journal, &off)) {
+		if (!(ret = journal_read_u64(journal, &len)))
+			break;
+		while (ret && len > 0) {
+			size_t n = MIN(len, sizeof buf);
+			ret = read(journal, buf, n) == (ssize_t)n &&
+			      pwrite_all(fd, buf, n, off) == (ssize_t)n;
+			off += n;
+			len -= n;
+		}
+	}
+	struct timespec times[2] = {
+		{ .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = (int64_t)mtime, .tv_nsec = (int64_t)mtime_nsec },
+	};
+	return ret && ftruncate(fd, size) == 0 && futimens(fd, times) == 0 && fsync(fd) == 0;
+}
+
+static bool journal_rollback(TextSave *ctx) {
+	int journal = openat(ctx->dirfd, ctx->journal, O_RDONLY);
+	if (journal == -1)
+		return false;
+	/* the file is in a state we caused, even if the last write failed half way */
+	bool ret = journal_apply(ctx->fd, journal, false);
+	close(journal);
+	return ret;
+}
+
+bool text_save_rollback(const char *filename) {
+	char *name = journal_name(filename);
+	if (!name)
+		return false;
+	int fd = -1, journal = open(name, O_RDONLY);
+	bool ret = journal != -1 &&
+	           (fd = open(filename, O_RDWR)) != -1 &&
+	           journal_apply(fd, journal, true) &&
+	           unlink(name) == 0;
+	int saved_errno = errno;
+	if (journal != -1)
+		close(journal);
+	if (fd != -1)
+		close(fd);
+	free(name);
+	errno = saved_errno;
+	return ret;
+}
+
+/* Replace all pages of a block mmap(2)-ed from the original file which overlap
+ * one of the given (sorted) ranges, by a private copy. Subsequent in place
+ * modifications of the file will thus not affect the pieces referring to it.
+ * See text_save_begin_inplace for the same approach applied to the whole block.
+ */
+bool block_detach(Block *blk, const Array *ranges) {
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char tmpname[32] = "/tmp/vis-XXXXXX";
+	if (pagesize <= 0)
+		return false;
+	int fd = mkstemp(tmpname);
+	if (fd == -1)
+		return false;
+	bool ret = unlink(tmpname) == 0;
+	size_t detached = 0;
+	off_t offset = 0;
+	for (size_t i = 0, len = array_length(ranges); ret && i < len; i++) {
+		Filerange *r = array_get(ranges, i);
+		if (r->start >= blk->size)
+			break;
+		size_t start = r->start - r->start % pagesize;
+		size_t end = MIN(r->end, blk->size);
+		end += (pagesize - end % pagesize) % pagesize;
+		if (start < detached)
+			start = detached;
+		if (start >= end)
+			continue;
+		size_t size = end - start;
+		ret = write_all(fd, blk->data + start, size) == (ssize_t)size &&
+		      mmap(blk->data + start, size, PROT_READ, MAP_SHARED|MAP_FIXED, fd, offset) != MAP_FAILED;
+		offset += size;
+		detached = end;
+	}
+	if (close(fd) == -1)
+		ret = false;
+	return ret;
+}
+
+bool block_page(Block *blk, size_t start, size_t end, int fd, off_t offset) {
+	size_t size = end - start;
+	return pwrite_all(fd, blk->data + start, size, offset) == (ssize_t)size &&
+	       mmap(blk->data + start, size, PROT_READ, MAP_SHARED|MAP_FIXED, fd, offset) != MAP_FAILED;
+}
+
+static ssize_t text_save_write_incremental(TextSave *ctx) {
+	Text *txt = ctx->txt;
+	size_t size = text_size(txt);
+	if (!journal_write(ctx))
+		return -1;
+
+	Block *block = text_block_mmaped(txt);
+	if (block) {
+		Filerange truncated = { .start = size, .end = ctx->saved_size };
+		if (size < ctx->saved_size && !array_add(&ctx->ranges, &truncated))
+			return -1;
+		bool detached = block_detach(block, &ctx->ranges);
+		if (size < ctx->saved_size)
+			array_remove(&ctx->ranges, array_length(&ctx->ranges)-1);
+		if (!detached)
+			return -1;
+	}
+
+	/* the file keeps the size and modification time recorded in the journal
+	 * throughout the save, except for the moment between a write and the
+	 * following journal_touch */
+	if (size != ctx->saved_size && ftruncate(ctx->fd, size) == -1)
+		goto err;
+	if (!journal_touch(ctx))
+		goto err;
+	for (size_t i = 0, len = array_length(&ctx->ranges); i < len; i++) {
+		Filerange *r = array_get(&ctx->ranges, i);
+		ssize_t written = text_pwrite_range(txt, r, ctx->fd);
+		if (written == -1 || (size_t)written != text_range_size(r) || !journal_touch(ctx))
+			goto err;
+	}
+
+	/* further writes append to the new content */
+	if (lseek(ctx->fd, size, SEEK_SET) == -1)
+		goto err;
+	return size;
+err:
+	if (ctx->journal && journal_rollback(ctx))
+		unlinkat(ctx->dirfd, ctx->journal, 0);
+	/* otherwise keep the journal, it can be applied by text_save_rollback */
+	free(ctx->journal);
+	ctx->journal = NULL;
+	return -1;
+}
+
+static bool text_save_flush_incremental(TextSave *ctx) {
+	if (!text_save_flush_inplace(ctx))
+		return false;
+	/* new content is on disk, the journal is no longer needed. make
+	 * sure it does not reappear after a crash and undo the save. */
+	if (unlinkat(ctx->dirfd, ctx->journal, 0) == -1)
+		return false;
+	free(ctx->journal);
+	ctx->journal = NULL;
+	int dir = dir_open(ctx);
+	return dir != -1 && dir_sync(dir);
+}
+
+/* Copy len bytes starting at offset of the original file to the current
+ * position of the file being written. Shares the underlying storage using
+ * FICLONERANGE where supported (e.g. btrfs, XFS), otherwise copy_file_range(2)
+ * avoids the round trip through user space. Returns the number of copied
+ * bytes or -1 if nothing could be copied. */
+static ssize_t copy_range(TextSave *ctx, off_t offset, size_t len) {
+#if HAVE_FICLONERANGE
+	off_t pos = lseek(ctx->fd, 0, SEEK_CUR);
+	off_t align = ctx->blksize;
+	if (pos != -1 && align > 0 && offset % align == 0 && pos % align == 0 && len % align == 0) {
+		struct file_clone_range clone = {
+			.src_fd = ctx->srcfd,
+			.src_offset = offset,
+			.src_length = len,
+			.dest_offset = pos,
+		};
+		if (ioctl(ctx->fd, FICLONERANGE, &clone) == 0 && lseek(ctx->fd, len, SEEK_CUR) != -1)
+			return len;
+	}
+#endif
+#if HAVE_COPY_FILE_RANGE
+	size_t rem = len;
+	while (rem > 0) {
+		ssize_t copied = copy_file_range(ctx->srcfd, &offset, ctx->fd, NULL, rem, 0);
+		if (copied < 0) {
+			if (errno == EINTR)
+				continue;
+			return rem == len ? -1 : (ssize_t)(len - rem);
+		} else if (copied == 0) {
+			break;
+		}
+		rem -= copied;
+	}
+	return len - rem;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/* Write file range of an atomic save, parts of the text which are still
+ * stored at a known location of the original file are copied from there.
+ * If that fails, for example because the file systems differ, we fall back
+ * to regular writes for the remaining data. */
+static ssize_t text_save_write_copy(TextSave *ctx, const Filerange *range) {
+	Text *txt = ctx->txt;
+	size_t size = text_range_size(range), rem = size;
+	for (Iterator it = text_iterator_get(txt, range->start);
+	     rem > 0 && text_iterator_valid(&it);
+	     text_iterator_next(&it)) {
+		const char *data = it.text;
+		size_t prem = MIN((size_t)(it.end - it.text), rem);
+		while (prem > 0) {
+			off_t offset = -1;
+			size_t len = text_saved_offset(txt, data, prem, &offset);
+			ssize_t written = 0;
+			if (offset != -1 && ctx->srcfd != -1) {
+				written = copy_range(ctx, offset, len);
+				if (written == -1) {
+					close(ctx->srcfd);
+					ctx->srcfd = -1;
+					written = 0;
+				}
+			}
+			if ((size_t)written < len) {
+				ssize_t n = write_all(ctx->fd, data + written, len - written);
+				if (n == -1)
+					return -1;
+				written += n;
+			}
+			rem -= written;
+			if ((size_t)written != len)
+				return size - rem;
+			data += len;
+			prem -= len;
+		}
+	}
+	return size - rem;
 }
 
 TextSave *text_save_begin(Text *txt, int dirfd, const char *filename, enum TextSaveMethod type) {
@@ -438,11 +1181,16 @@ TextSave *text_save_begin(Text *txt, int dirfd, const char *filename, enum TextS
 		return NULL;
 	ctx->txt = txt;
 	ctx->fd = -1;
+	ctx->srcfd = -1;
 	ctx->dirfd = dirfd;
+	array_init_sized(&ctx->ranges, sizeof(Filerange));
 	if (!(ctx->filename = strdup(filename)))
 		goto err;
+	if (type == TEXT_SAVE_INCREMENTAL && text_save_begin_incremental(ctx))
+		return ctx;
 	errno = 0;
-	if ((type == TEXT_SAVE_AUTO || type == TEXT_SAVE_ATOMIC) && text_save_begin_atomic(ctx))
+	if ((type == TEXT_SAVE_AUTO || type == TEXT_SAVE_ATOMIC || type == TEXT_SAVE_INCREMENTAL) &&
+	    text_save_begin_atomic(ctx))
 		return ctx;
 	if (errno == ENOSPC)
 		goto err;
@@ -453,36 +1201,113 @@ err:
 	return NULL;
 }
 
-bool text_save_commit(TextSave *ctx) {
-	if (!ctx)
-		return true;
-	bool ret;
+/* flush file content to disk and move it to its final destination, for
+ * atomic saves the directory entry still needs to be synced afterwards */
+static bool text_save_flush(TextSave *ctx) {
 	switch (ctx->type) {
 	case TEXT_SAVE_ATOMIC:
-		ret = text_save_commit_atomic(ctx);
-		break;
+		return text_save_flush_atomic(ctx);
 	case TEXT_SAVE_INPLACE:
-		ret = text_save_commit_inplace(ctx);
-		break;
+		return text_save_flush_inplace(ctx);
+	case TEXT_SAVE_INCREMENTAL:
+		return text_save_flush_incremental(ctx);
 	default:
-		ret = false;
-		break;
+		return false;
 	}
+}
 
+bool text_save_commit(TextSave *ctx) {
+	if (!ctx)
+		return true;
+	bool ret = text_save_flush(ctx);
+	if (ret && ctx->type == TEXT_SAVE_ATOMIC) {
+		int dir = dir_open(ctx);
+		ret = dir != -1 && dir_sync(dir);
+	}
+	if (ret)
+		text_saved(ctx->txt, &ctx->meta, ctx->complete);
 	text_save_cancel(ctx);
 	return ret;
 }
 
+/* Instead of syncing one file after another, first initiate the write back
+ * of all of them, such that the I/O is performed concurrently and the later
+ * fsync(2) calls mostly wait for already completed requests. Each file is
+ * still synced before it is renamed into place. Finally every directory
+ * containing atomically saved files is synced once.
+ */
+bool text_save_commit_all(TextSave *ctx[], size_t count, int errors[]) {
+	bool ret = true;
+#if HAVE_SYNC_FILE_RANGE
+	for (size_t i = 0; i < count; i++) {
+		if (ctx[i] && ctx[i]->fd != -1)
+			sync_file_range(ctx[i]->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+	}
+#endif
+	for (size_t i = 0; i < count; i++) {
+		errno = 0;
+		bool flushed = !ctx[i] || text_save_flush(ctx[i]);
+		errors[i] = flushed ? 0 : (errno ? errno : EIO);
+	}
+
+	/* sync every directory once, errors apply to all files within it */
+	Array dirs;
+	array_init_sized(&dirs, sizeof(SyncedDir));
+	for (size_t i = 0; i < count; i++) {
+		if (!ctx[i] || errors[i] || ctx[i]->type != TEXT_SAVE_ATOMIC)
+			continue;
+		struct stat meta;
+		int dir = dir_open(ctx[i]);
+		if (dir == -1 || fstat(dir, &meta) == -1) {
+			errors[i] = errno;
+			if (dir != -1)
+				close(dir);
+			continue;
+		}
+		SyncedDir *synced = NULL;
+		for (size_t j = 0, len = array_length(&dirs); j < len && !synced; j++) {
+			SyncedDir *d = array_get(&dirs, j);
+			if (d->dev == meta.st_dev && d->ino == meta.st_ino)
+				synced = d;
+		}
+		if (synced) {
+			close(dir);
+			errors[i] = synced->error;
+			continue;
+		}
+		SyncedDir d = { .dev = meta.st_dev, .ino = meta.st_ino };
+		d.error = dir_sync(dir) ? 0 : errno;
+		errors[i] = d.error;
+		array_add(&dirs, &d);
+	}
+	array_release(&dirs);
+
+	for (size_t i = 0; i < count; i++) {
+		if (!ctx[i])
+			continue;
+		if (!errors[i])
+			text_saved(ctx[i]->txt, &ctx[i]->meta, ctx[i]->complete);
+		else
+			ret = false;
+		text_save_cancel(ctx[i]);
+	}
+	return ret;
+}
+
 void text_save_cancel(TextSave *ctx) {
 	if (!ctx)
 		return;
 	int saved_errno = errno;
 	if (ctx->fd != -1)
 		close(ctx->fd);
+	if (ctx->srcfd != -1)
+		close(ctx->srcfd);
 	if (ctx->tmpname && ctx->tmpname[0])
 		unlinkat(ctx->dirfd, ctx->tmpname, 0);
 	free(ctx->tmpname);
+	free(ctx->journal);
 	free(ctx->filename);
+	array_release(&ctx->ranges);
 	free(ctx);
 	errno = saved_errno;
 }
@@ -505,7 +1330,7 @@ bool text_save_method(Text *txt, const char *filename, enum TextSaveMethod metho
 
 bool text_saveat_method(Text *txt, int dirfd, const char *filename, enum TextSaveMethod method) {
 	if (!filename) {
-		text_saved(txt, NULL);
+		text_saved(txt, NULL, false);
 		return true;
 	}
 	TextSave *ctx = text_save_begin(txt, dirfd, filename, method);
@@ -521,7 +1346,27 @@ bool text_saveat_method(Text *txt, int dirfd, const char *filename, enum TextSav
 }
 
 ssize_t text_save_write_range(TextSave *ctx, const Filerange *range) {
-	return text_write_range(ctx->txt, range, ctx->fd);
+	Filerange all = text_range_new(0, text_size(ctx->txt));
+	bool whole = text_range_equal(range, &all);
+	ssize_t written;
+	if (ctx->type == TEXT_SAVE_INCREMENTAL && !ctx->written) {
+		if (!whole) {
+			/* only complete rewrites can be performed incrementally */
+			close(ctx->fd);
+			ctx->fd = -1;
+			if (!text_save_begin_atomic(ctx))
+				return -1;
+			return text_save_write_range(ctx, range);
+		}
+		written = text_save_write_incremental(ctx);
+	} else if (ctx->srcfd != -1) {
+		written = text_save_write_copy(ctx, range);
+	} else {
+		written = text_write_range(ctx->txt, range, ctx->fd);
+	}
+	ctx->complete = !ctx->written && whole && written != -1 && (size_t)written == text_range_size(&all);
+	ctx->written = true;
+	return written;
 }
 
 ssize_t text_write(const Text *txt, int fd) {
@@ -530,19 +1375,248 @@ ssize_t text_write(const Text *txt, int fd) {
 }
 
 ssize_t text_write_range(const Text *txt, const Filerange *range, int fd) {
-	size_t size = text_range_size(range), rem = size;
-	for (Iterator it = text_iterator_get(txt, range->start);
-	     rem > 0 && text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		size_t prem = it.end - it.text;
-		if (prem > rem)
-			prem = rem;
-		ssize_t written = write_all(fd, it.text, prem);
-		if (written == -1)
-			return -1;
-		rem -= written;
-		if ((size_t)written != prem)
+	return text_writev_range(txt, range, fd, false);
+}
+
+size_t text_iovec(const Text *txt, const Filerange *range, struct iovec *iov, size_t count) {
+	size_t rem = text_range_size(range);
+	Iterator it = text_iterator_get(txt, range->start);
+	return iterator_iovec(&it, &rem, iov, count);
+}
+
+/* An append only log of all modifications performed since the file was
+ * loaded or last saved. It starts with a JournalHeader identifying the file
+ * content to which the changes apply, followed by a sequence of records
+ * each immediately followed by the inserted data (if any). Records are
+ * buffered and written in batches, a checkpoint record is appended whenever
+ * the journal is synced to disk and marks a consistent state of the text. */
+struct Journal {
+	int fd;                    /* journal file, opened for appending */
+	char *filename;            /* name of the journal, used to remove it */
+	Buffer records;            /* records not yet written to the journal */
+	bool pending;              /* whether changes were recorded since the last checkpoint */
+	int error;                 /* errno value of a failed write, zero otherwise */
+};
+
+typedef struct {
+	char magic[8];             /* JOURNAL_MAGIC, without terminating NUL byte */
+	uint64_t dev, ino;         /* identity of the file the changes apply to */
+	uint64_t size;             /* size of said file content */
+	int64_t mtime;             /* modification time of said file content */
+	int64_t mtime_nsec;        /* nanosecond part of the modification time */
+} JournalHeader;
+
+typedef struct {
+	uint64_t pos;              /* position of the change or JOURNAL_CHECKPOINT */
+	uint64_t del;              /* number of deleted bytes, text size for checkpoints */
+	uint64_t len;              /* number of inserted bytes following the record */
+} JournalRecord;
+
+#define JOURNAL_MAGIC "visjrnl2"
+#define JOURNAL_CHECKPOINT UINT64_MAX
+/* Records are written once this many bytes are buffered, larger insertions
+ * are written directly. */
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+
+static Journal *journal_alloc(const char *filename) {
+	Journal *j = calloc(1, sizeof *j);
+	if (!j)
+		return NULL;
+	j->fd = -1;
+	buffer_init(&j->records);
+	if (!(j->filename = strdup(filename))) {
+		free(j);
+		return NULL;
+	}
+	return j;
+}
+
+/* flush directory entry of the journal to disk, such that it is found after a crash */
+static bool journal_dir_sync(Journal *j) {
+	char *name = strdup(j->filename);
+	if (!name)
+		return false;
+	int dir = open(dirname(name), O_DIRECTORY|O_RDONLY);
+	free(name);
+	return dir != -1 && dir_sync(dir);
+}
+
+Journal *journal_open(const char *filename, const struct stat *base) {
+	Journal *j = journal_alloc(filename);
+	if (!j)
+		return NULL;
+	j->fd = open(filename, O_WRONLY|O_APPEND|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+	if (j->fd == -1)
+		goto err;
+	if (!journal_restart(j, base) || !journal_dir_sync(j)) {
+		int saved_errno = errno;
+		unlink(filename);
+		errno = saved_errno;
+		goto err;
+	}
+	return j;
+err: {
+		int saved_errno = errno;
+		journal_free(j, false);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+
+bool journal_restart(Journal *j, const struct stat *base) {
+	JournalHeader hdr = {
+		.dev = base->st_dev,
+		.ino = base->st_ino,
+		.size = base->st_size,
+		.mtime = base->st_mtime,
+		.mtime_nsec = stat_mtime_nsec(base),
+	};
+	memcpy(hdr.magic, JOURNAL_MAGIC, sizeof hdr.magic);
+	buffer_clear(&j->records);
+	j->pending = false;
+	j->error = 0;
+	errno = 0;
+	if (ftruncate(j->fd, 0) == -1 ||
+	    write_all(j->fd, (const char*)&hdr, sizeof hdr) != sizeof hdr ||
+	    fsync(j->fd) == -1) {
+		j->error = errno ? errno : EIO;
+		return false;
+	}
+	return true;
+}
+
+static bool journal_flush(Journal *j) {
+	size_t len = buffer_length(&j->records);
+	if (len > 0 && write_all(j->fd, buffer_content(&j->records), len) != (ssize_t)len)
+		return false;
+	buffer_clear(&j->records);
+	return true;
+}
+
+void journal_change(Journal *j, size_t pos, size_t del, const char *data, size_t len) {
+	if (j->error)
+		return;
+	JournalRecord rec = { .pos = pos, .del = del, .len = len };
+	bool direct = len >= JOURNAL_BUFFER_SIZE;
+	j->pending = true;
+	errno = 0;
+	if (!buffer_append(&j->records, &rec, sizeof rec) ||
+	    (!direct && len > 0 && !buffer_append(&j->records, data, len)))
+		goto err;
+	if (!direct && buffer_length(&j->records) < JOURNAL_BUFFER_SIZE)
+		return;
+	if (!journal_flush(j) || (direct && write_all(j->fd, data, len) != (ssize_t)len))
+		goto err;
+	return;
+err:
+	/* stop recording, the journal can only be replayed up to the last checkpoint */
+	j->error = errno ? errno : EIO;
+}
+
+bool journal_pending(const Journal *j) {
+	return j->pending && !j->error;
+}
+
+bool journal_checkpoint(Journal *j, size_t size) {
+	if (j->error) {
+		errno = j->error;
+		return false;
+	}
+	if (!j->pending)
+		return true;
+	JournalRecord rec = { .pos = JOURNAL_CHECKPOINT, .del = size };
+	errno = 0;
+	if (!buffer_append(&j->records, &rec, sizeof rec) ||
+	    !journal_flush(j) || fsync(j->fd) == -1) {
+		j->error = errno ? errno : EIO;
+		return false;
+	}
+	j->pending = false;
+	return true;
+}
+
+Journal *journal_recover(Text *txt, const char *filename) {
+	Journal *j = journal_alloc(filename);
+	char *buf = malloc(JOURNAL_BUFFER_SIZE);
+	if (!j || !buf)
+		goto err;
+	j->fd = open(filename, O_RDWR|O_APPEND);
+	if (j->fd == -1)
+		goto err;
+
+	JournalHeader hdr;
+	struct stat base = text_stat(txt);
+	if (pread_all(j->fd, (char*)&hdr, sizeof hdr, 0) != sizeof hdr ||
+	    memcmp(hdr.magic, JOURNAL_MAGIC, sizeof hdr.magic) != 0) {
+		/* journals written by other versions are treated as outdated */
+		bool version = memcmp(hdr.magic, JOURNAL_MAGIC, sizeof hdr.magic - 1) == 0;
+		errno = version ? ESTALE : EINVAL;
+		goto err;
+	}
+	if (hdr.dev != (uint64_t)base.st_dev || hdr.ino != (uint64_t)base.st_ino ||
+	    hdr.size != (uint64_t)base.st_size || hdr.mtime != (int64_t)base.st_mtime ||
+	    hdr.mtime_nsec != (int64_t)stat_mtime_nsec(&base)) {
+		errno = ESTALE;
+		goto err;
+	}
+
+	/* apply all records, stop at the first incomplete or invalid one */
+	off_t offset = sizeof hdr, checkpoint = offset;
+	bool pending = false;
+	JournalRecord rec;
+	while (pread_all(j->fd, (char*)&rec, sizeof rec, offset) == sizeof rec) {
+		offset += sizeof rec;
+		if (rec.pos == JOURNAL_CHECKPOINT) {
+			if (rec.del != text_size(txt))
+				break;
+			text_snapshot(txt);
+			checkpoint = offset;
+			pending = false;
+			continue;
+		}
+		if (rec.pos > text_size(txt) || !text_delete(txt, rec.pos, rec.del))
+			break;
+		pending = true;
+		size_t pos = rec.pos;
+		uint64_t rem = rec.len;
+		while (rem > 0) {
+			size_t len = rem > JOURNAL_BUFFER_SIZE ? JOURNAL_BUFFER_SIZE : rem;
+			if (pread_all(j->fd, buf, len, offset) != (ssize_t)len ||
+			    !text_insert(txt, pos, buf, len))
+				break;
+			offset += len;
+			pos += len;
+			rem -= len;
+		}
+		if (rem > 0)
 			break;
 	}
-	return size - rem;
+
+	/* revert changes after the last checkpoint, they were never synced */
+	if (pending)
+		text_undo(txt);
+	if (ftruncate(j->fd, checkpoint) == -1)
+		goto err;
+	free(buf);
+	return j;
+err:
+	free(buf);
+	if (j) {
+		int saved_errno = errno;
+		journal_free(j, false);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+
+void journal_free(Journal *j, bool remove) {
+	if (!j)
+		return;
+	if (j->fd != -1)
+		close(j->fd);
+	if (remove)
+		unlink(j->filename);
+	buffer_release(&j->records);
+	free(j->filename);
+	free(j);
 }
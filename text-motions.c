@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <limits.h>
 #include "text-motions.h"
+#include "text-internal.h"
 #include "text-util.h"
 #include "util.h"
 #include "text-objects.h"
@@ -164,10 +165,192 @@ size_t text_line_offset(Text *txt, size_t pos, size_t off) {
 	return it.pos;
 }
 
+/* Within long lines, the number of characters and the display width
+ * preceding a character boundary are remembered about every COLUMN_INTERVAL
+ * bytes. Column queries resume from the closest such checkpoint. They are
+ * kept for the COLUMN_LINES most recently used lines and discarded from the
+ * position of a modification onwards. */
+#define COLUMN_INTERVAL 1024
+#define COLUMN_LINES 8
+
+typedef struct {
+	size_t pos;             /* absolute position of a character boundary */
+	int chars;              /* number of characters from the line begin up to it */
+	int width;              /* their display width */
+} ColumnCheckpoint;
+
+typedef struct {
+	size_t bol;             /* line begin, EPOS if unused */
+	Array checkpoints;      /* ColumnCheckpoint, ordered by position */
+	bool complete;          /* whether the end of the line was reached */
+	unsigned long used;     /* time of last use, for eviction */
+} ColumnLine;
+
+struct ColumnCache {
+	ColumnLine lines[COLUMN_LINES];
+	unsigned long time;
+};
+
+ColumnCache *columns_new(void) {
+	ColumnCache *cache = calloc(1, sizeof *cache);
+	if (!cache)
+		return NULL;
+	for (size_t i = 0; i < LENGTH(cache->lines); i++) {
+		cache->lines[i].bol = EPOS;
+		array_init_sized(&cache->lines[i].checkpoints, sizeof(ColumnCheckpoint));
+	}
+	return cache;
+}
+
+void columns_free(ColumnCache *cache) {
+	if (!cache)
+		return;
+	for (size_t i = 0; i < LENGTH(cache->lines); i++)
+		array_release(&cache->lines[i].checkpoints);
+	free(cache);
+}
+
+void columns_invalidate(ColumnCache *cache, size_t pos) {
+	for (size_t i = 0; i < LENGTH(cache->lines); i++) {
+		ColumnLine *line = &cache->lines[i];
+		if (line->bol == EPOS)
+			continue;
+		if (pos <= line->bol) {
+			line->bol = EPOS;
+			array_clear(&line->checkpoints);
+			continue;
+		}
+		/* a character boundary depends on the codepoint following it */
+		size_t len = array_length(&line->checkpoints);
+		while (len > 0) {
+			ColumnCheckpoint *cp = array_get(&line->checkpoints, len-1);
+			if (cp->pos + MB_LEN_MAX <= pos)
+				break;
+			len--;
+		}
+		array_truncate(&line->checkpoints, len);
+		line->complete = false;
+	}
+}
+
+/* display width of the codepoint stored in buf, the same conversion state
+ * has to be used for consecutive calls */
+static int codepoint_width(const char *buf, size_t len, mbstate_t *ps) {
+	wchar_t wc;
+	size_t wclen = mbrtowc(&wc, buf, len, ps);
+	if (wclen == (size_t)-1 && errno == EILSEQ) {
+		*ps = (mbstate_t){0};
+		/* assume a replacement symbol will be displayed */
+		return 1;
+	} else if (wclen == (size_t)-2) {
+		/* do nothing, advance to next character */
+		return 0;
+	} else if (wclen == 0) {
+		/* assume NUL byte will be displayed as ^@ */
+		return 2;
+	} else if (buf[0] == '\t') {
+		return 1;
+	} else {
+		int w = wcwidth(wc);
+		if (w == -1)
+			w = 2; /* assume non-printable will be displayed as ^{char} */
+		return w;
+	}
+}
+
+/* whether the checkpoint precedes the given position, character and width */
+static bool column_before(const ColumnCheckpoint *cp, size_t pos, int chars, int width) {
+	return cp->pos <= pos && cp->chars <= chars && cp->width < width;
+}
+
+static ColumnLine *column_line(ColumnCache *cache, size_t bol) {
+	ColumnLine *line = &cache->lines[0];
+	for (size_t i = 0; i < LENGTH(cache->lines); i++) {
+		if (cache->lines[i].bol == bol) {
+			line = &cache->lines[i];
+			break;
+		}
+		if (cache->lines[i].used < line->used)
+			line = &cache->lines[i];
+	}
+	if (line->bol != bol) {
+		line->bol = bol;
+		line->complete = false;
+		array_clear(&line->checkpoints);
+	}
+	line->used = ++cache->time;
+	return line;
+}
+
+/* add checkpoints to the line until one is found which does not precede
+ * the given position, character and width */
+static void column_extend(Text *txt, ColumnLine *line, size_t pos, int chars, int width) {
+	size_t len = array_length(&line->checkpoints);
+	ColumnCheckpoint cp = { .pos = line->bol }, *last = array_get(&line->checkpoints, len-1);
+	if (last)
+		cp = *last;
+	size_t next = cp.pos + COLUMN_INTERVAL;
+	mbstate_t ps = { 0 };
+	Iterator it = text_iterator_get(txt, cp.pos);
+	while (column_before(&cp, pos, chars, width)) {
+		char c;
+		size_t start = it.pos;
+		if (!text_iterator_byte_get(&it, &c) || c == '\n' || !text_iterator_char_next(&it, &c)) {
+			line->complete = true;
+			return;
+		}
+		cp.chars++;
+		for (Iterator cit = text_iterator_get(txt, start); cit.pos < it.pos; ) {
+			char buf[MB_LEN_MAX];
+			size_t n = text_bytes_get(txt, cit.pos, sizeof buf, buf);
+			cp.width += codepoint_width(buf, n, &ps);
+			if (!text_iterator_codepoint_next(&cit, NULL))
+				break;
+		}
+		cp.pos = it.pos;
+		if (cp.pos >= next && mbsinit(&ps)) {
+			if (!array_add(&line->checkpoints, &cp))
+				return;
+			next = cp.pos + COLUMN_INTERVAL;
+		}
+	}
+}
+
+/* Last checkpoint of the line starting at bol which precedes the given
+ * position, character and width. Targets close to the line begin are not
+ * worth remembering, the line begin itself is returned for them. */
+static ColumnCheckpoint column_checkpoint(Text *txt, size_t bol, size_t pos, int chars, int width) {
+	ColumnCheckpoint cp = { .pos = bol };
+	if (pos - bol < COLUMN_INTERVAL || chars < COLUMN_INTERVAL / 8 || width < COLUMN_INTERVAL / 8)
+		return cp;
+	ColumnCache *cache = text_columns(txt);
+	if (!cache)
+		return cp;
+	ColumnLine *line = column_line(cache, bol);
+	size_t len = array_length(&line->checkpoints);
+	ColumnCheckpoint *last = array_get(&line->checkpoints, len-1);
+	if (!line->complete && (!last || column_before(last, pos, chars, width)))
+		column_extend(txt, line, pos, chars, width);
+	/* binary search for the last one preceding the target */
+	size_t lo = 0, hi = array_length(&line->checkpoints);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (column_before(array_get(&line->checkpoints, mid), pos, chars, width))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0)
+		cp = *(ColumnCheckpoint*)array_get(&line->checkpoints, lo-1);
+	return cp;
+}
+
 size_t text_line_char_set(Text *txt, size_t pos, int count) {
 	char c;
 	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+	ColumnCheckpoint cp = column_checkpoint(txt, bol, EPOS, count, INT_MAX);
+	Iterator it = text_iterator_get(txt, cp.pos);
+	count -= cp.chars;
 	if (text_iterator_byte_get(&it, &c) && c != '\n')
 		while (count-- > 0 && text_iterator_char_next(&it, &c) && c != '\n');
 	return it.pos;
@@ -175,9 +358,10 @@ size_t text_line_char_set(Text *txt, size_t pos, int count) {
 
 int text_line_char_get(Text *txt, size_t pos) {
 	char c;
-	int count = 0;
 	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+	ColumnCheckpoint cp = column_checkpoint(txt, bol, pos, INT_MAX, INT_MAX);
+	int count = cp.chars;
+	Iterator it = text_iterator_get(txt, cp.pos);
 	if (text_iterator_byte_get(&it, &c) && c != '\n') {
 		while (it.pos < pos && c != '\n' && text_iterator_char_next(&it, &c))
 			count++;
@@ -186,36 +370,18 @@ int text_line_char_get(Text *txt, size_t pos) {
 }
 
 int text_line_width_get(Text *txt, size_t pos) {
-	int width = 0;
 	mbstate_t ps = { 0 };
 	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+	ColumnCheckpoint cp = column_checkpoint(txt, bol, pos, INT_MAX, INT_MAX);
+	int width = cp.width;
+	Iterator it = text_iterator_get(txt, cp.pos);
 
 	while (it.pos < pos) {
 		char buf[MB_LEN_MAX];
 		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
 		if (len == 0 || buf[0] == '\n')
 			break;
-		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
-		if (wclen == (size_t)-1 && errno == EILSEQ) {
-			ps = (mbstate_t){0};
-			/* assume a replacement symbol will be displayed */
-			width++;
-		} else if (wclen == (size_t)-2) {
-			/* do nothing, advance to next character */
-		} else if (wclen == 0) {
-			/* assume NUL byte will be displayed as ^@ */
-			width += 2;
-		} else if (buf[0] == '\t') {
-			width++;
-		} else {
-			int w = wcwidth(wc);
-			if (w == -1)
-				w = 2; /* assume non-printable will be displayed as ^{char} */
-			width += w;
-		}
-
+		width += codepoint_width(buf, len, &ps);
 		if (!text_iterator_codepoint_next(&it, NULL))
 			break;
 	}
@@ -224,36 +390,18 @@ int text_line_width_get(Text *txt, size_t pos) {
 }
 
 size_t text_line_width_set(Text *txt, size_t pos, int width) {
-	int cur_width = 0;
 	mbstate_t ps = { 0 };
 	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+	ColumnCheckpoint cp = column_checkpoint(txt, bol, EPOS, INT_MAX, width);
+	int cur_width = cp.width;
+	Iterator it = text_iterator_get(txt, cp.pos);
 
 	for (;;) {
 		char buf[MB_LEN_MAX];
 		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
 		if (len == 0 || buf[0] == '\n')
 			break;
-		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
-		if (wclen == (size_t)-1 && errno == EILSEQ) {
-			ps = (mbstate_t){0};
-			/* assume a replacement symbol will be displayed */
-			cur_width++;
-		} else if (wclen == (size_t)-2) {
-			/* do nothing, advance to next character */
-		} else if (wclen == 0) {
-			/* assume NUL byte will be displayed as ^@ */
-			cur_width += 2;
-		} else if (buf[0] == '\t') {
-			cur_width++;
-		} else {
-			int w = wcwidth(wc);
-			if (w == -1)
-				w = 2; /* assume non-printable will be displayed as ^{char} */
-			cur_width += w;
-		}
-
+		cur_width += codepoint_width(buf, len, &ps);
 		if (cur_width >= width || !text_iterator_codepoint_next(&it, NULL))
 			break;
 	}
@@ -324,51 +472,143 @@ size_t text_range_line_prev(Text *txt, Filerange *r, size_t pos) {
 	return newpos != pos && r->start <= newpos ? newpos : EPOS;
 }
 
+/* Word motions classify characters by their first byte. The classes of all
+ * byte values are computed once per boundary function, runs of ASCII
+ * characters belonging to the same class are then skipped by looking at
+ * the piece data directly, instead of decoding one character at a time. */
+enum {
+	WORD_PUNCT,             /* boundary, but not space */
+	WORD_CHAR,              /* not a boundary */
+	WORD_SPACE,
+	WORD_CLASSES,
+};
+
+typedef struct {
+	int (*isboundary)(int);
+	bool match[WORD_CLASSES][256];
+} WordClasses;
+
+static const WordClasses *word_classes(int (*isboundary)(int)) {
+	static WordClasses cache[4];
+	static size_t evict;
+	for (size_t i = 0; i < LENGTH(cache); i++) {
+		if (cache[i].isboundary == isboundary)
+			return &cache[i];
+	}
+	WordClasses *wc = &cache[evict++ % LENGTH(cache)];
+	for (int c = 0; c < 256; c++) {
+		bool b = isboundary(c), s = isspace(c);
+		wc->match[WORD_PUNCT][c] = b && !s;
+		wc->match[WORD_CHAR][c] = !b;
+		wc->match[WORD_SPACE][c] = s;
+	}
+	wc->isboundary = isboundary;
+	return wc;
+}
+
+/* Move the iterator, located at a character of the given class, to the last
+ * of the directly following ASCII characters of the same class within the
+ * current piece. Each of them forms a character on its own. */
+static void word_run_next(Iterator *it, char *c, const bool *match) {
+	const char *s = it->text;
+	while (s + 1 < it->end && ISASCII(s[1]) && match[(unsigned char)s[1]])
+		s++;
+	it->pos += s - it->text;
+	it->text = s;
+	*c = *s;
+}
+
+/* same as word_run_next, but for the preceding characters */
+static void word_run_prev(Iterator *it, char *c, const bool *match) {
+	const char *s = it->text;
+	while (s > it->start && ISASCII(s[-1]) && match[(unsigned char)s[-1]])
+		s--;
+	it->pos -= it->text - s;
+	it->text = s;
+	*c = *s;
+}
+
+/* same as text_iterator_char_next, without decoding ASCII characters */
+static bool word_char_next(Iterator *it, char *c) {
+	if (it->text + 1 < it->end && ISASCII(it->text[1])) {
+		it->pos++;
+		*c = *++it->text;
+		return true;
+	}
+	return text_iterator_char_next(it, c);
+}
+
+/* same as text_iterator_char_prev, without decoding ASCII characters */
+static bool word_char_prev(Iterator *it, char *c) {
+	if (it->text > it->start && ISASCII(it->text[-1])) {
+		it->pos--;
+		*c = *--it->text;
+		return true;
+	}
+	return text_iterator_char_prev(it, c);
+}
+
+/* equivalent to: while (match(c) && text_iterator_char_next(it, &c)); */
+static void word_skip_next(Iterator *it, char *c, const bool *match) {
+	while (match[(unsigned char)*c]) {
+		word_run_next(it, c, match);
+		if (!word_char_next(it, c))
+			break;
+	}
+}
+
+/* equivalent to: while (match(c) && text_iterator_char_prev(it, &c)); */
+static void word_skip_prev(Iterator *it, char *c, const bool *match) {
+	while (match[(unsigned char)*c]) {
+		word_run_prev(it, c, match);
+		if (!word_char_prev(it, c))
+			break;
+	}
+}
+
 size_t text_customword_start_next(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
+	const WordClasses *wc = word_classes(isboundary);
 	Iterator it = text_iterator_get(txt, pos);
 	if (!text_iterator_byte_get(&it, &c))
 		return pos;
-	if (boundary(c))
-		while (boundary(c) && !space(c) && text_iterator_char_next(&it, &c));
-	else
-		while (!boundary(c) && text_iterator_char_next(&it, &c));
-	while (space(c) && text_iterator_char_next(&it, &c));
+	word_skip_next(&it, &c, wc->match[boundary(c) ? WORD_PUNCT : WORD_CHAR]);
+	word_skip_next(&it, &c, wc->match[WORD_SPACE]);
 	return it.pos;
 }
 
 size_t text_customword_start_prev(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
+	const WordClasses *wc = word_classes(isboundary);
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_char_prev(&it, &c) && space(c));
-	if (boundary(c))
-		do pos = it.pos; while (text_iterator_char_prev(&it, &c) && boundary(c) && !space(c));
-	else
-		do pos = it.pos; while (text_iterator_char_prev(&it, &c) && !boundary(c));
+	if (word_char_prev(&it, &c))
+		word_skip_prev(&it, &c, wc->match[WORD_SPACE]);
+	const bool *match = wc->match[boundary(c) ? WORD_PUNCT : WORD_CHAR];
+	for (pos = it.pos; word_char_prev(&it, &c) && match[(unsigned char)c]; pos = it.pos)
+		word_run_prev(&it, &c, match);
 	return pos;
 }
 
 size_t text_customword_end_next(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
+	const WordClasses *wc = word_classes(isboundary);
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_char_next(&it, &c) && space(c));
-	if (boundary(c))
-		do pos = it.pos; while (text_iterator_char_next(&it, &c) && boundary(c) && !space(c));
-	else
-		do pos = it.pos; while (text_iterator_char_next(&it, &c) && !isboundary(c));
+	if (word_char_next(&it, &c))
+		word_skip_next(&it, &c, wc->match[WORD_SPACE]);
+	const bool *match = wc->match[boundary(c) ? WORD_PUNCT : WORD_CHAR];
+	for (pos = it.pos; word_char_next(&it, &c) && match[(unsigned char)c]; pos = it.pos)
+		word_run_next(&it, &c, match);
 	return pos;
 }
 
 size_t text_customword_end_prev(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
+	const WordClasses *wc = word_classes(isboundary);
 	Iterator it = text_iterator_get(txt, pos);
 	if (!text_iterator_byte_get(&it, &c))
 		return pos;
-	if (boundary(c))
-		while (boundary(c) && !space(c) && text_iterator_char_prev(&it, &c));
-	else
-		while (!boundary(c) && text_iterator_char_prev(&it, &c));
-	while (space(c) && text_iterator_char_prev(&it, &c));
+	word_skip_prev(&it, &c, wc->match[boundary(c) ? WORD_PUNCT : WORD_CHAR]);
+	word_skip_prev(&it, &c, wc->match[WORD_SPACE]);
 	return it.pos;
 }
 
@@ -404,6 +644,19 @@ size_t text_word_start_prev(Text *txt, size_t pos) {
 	return text_customword_start_prev(txt, pos, is_word_boundary);
 }
 
+#define sentence_end(c) ((c) == '.' || (c) == '?' || (c) == '!')
+
+/* The motions below potentially traverse the whole file. Instead of
+ * stepping through it byte by byte, the piece data is scanned directly
+ * and the iterator only consulted when a match straddles a piece boundary. */
+
+static size_t sentence_start(Iterator *it) {
+	char c;
+	do text_iterator_byte_next(it, NULL);
+	while (text_iterator_byte_get(it, &c) && space(c));
+	return it->pos;
+}
+
 size_t text_sentence_next(Text *txt, size_t pos) {
 	char c, prev = 'X';
 	Iterator it = text_iterator_get(txt, pos), rev = it;
@@ -415,15 +668,16 @@ size_t text_sentence_next(Text *txt, size_t pos) {
 		text_iterator_byte_prev(&rev, NULL);
 	prev = rev.pos == 0 ? '.' : prev; /* simulate punctuation at BOF */
 
-	do {
-		if ((prev == '.' || prev == '?' || prev == '!') && space(c)) {
-			do text_iterator_byte_next(&it, NULL);
-			while (text_iterator_byte_get(&it, &c) && space(c));
-			return it.pos;
+	for (; text_iterator_valid(&it); text_iterator_next(&it)) {
+		for (const char *s = it.text; s < it.end; prev = *s++) {
+			if (sentence_end(prev) && space(*s)) {
+				it.pos += s - it.text;
+				it.text = s;
+				return sentence_start(&it);
+			}
 		}
-		prev = c;
-	} while (text_iterator_byte_next(&it, &c));
-	return it.pos;
+	}
+	return text_size(txt);
 }
 
 size_t text_sentence_prev(Text *txt, size_t pos) {
@@ -431,16 +685,24 @@ size_t text_sentence_prev(Text *txt, size_t pos) {
 	bool content = false;
 	Iterator it = text_iterator_get(txt, pos);
 
-	while (it.pos != 0 && text_iterator_byte_prev(&it, &c)) {
-		if (content && space(prev) && (c == '.' || c == '?' || c == '!')) {
-			do text_iterator_byte_next(&it, NULL);
-			while (text_iterator_byte_get(&it, &c) && space(c));
-			return it.pos;
+	if (!text_iterator_valid(&it))
+		return pos;
+
+	for (; text_iterator_valid(&it); text_iterator_prev(&it)) {
+		for (const char *s = it.text; s > it.start; prev = c) {
+			c = *--s;
+			if (sentence_end(c) && content && space(prev)) {
+				it.pos -= it.text - s;
+				it.text = s;
+				return sentence_start(&it);
+			}
+			if (!content)
+				content = !space(c);
 		}
-		content |= !space(c);
-		prev = c;
-	} /* The loop only ends on hitting BOF or error */
-	if (content) /* starting pos was after first sentence in file => find that sentences start */
+	}
+	/* hit BOF, starting pos was after first sentence in file => find that sentences start */
+	it = text_iterator_get(txt, 0);
+	if (content)
 		while (text_iterator_byte_get(&it, &c) && space(c))
 			text_iterator_byte_next(&it, NULL);
 	return it.pos;
@@ -463,46 +725,83 @@ size_t text_paragraph_prev(Text *txt, size_t pos) {
 	return text_line_blank_prev(txt, it.pos);
 }
 
-size_t text_line_empty_next(Text *txt, size_t pos) {
+/* Find the next newline at or after the iterator which is followed by a line
+ * consisting only of blanks (if `blanks` is set) and a terminating newline.
+ * On success the iterator points to the terminating newline. */
+static bool line_blank_next(Iterator *it, bool blanks, size_t *bol) {
 	char c;
-	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_byte_find_next(&it, '\n')) {
-		if (text_iterator_byte_next(&it, &c) && c == '\n')
-			return it.pos;
+	while (text_iterator_byte_find_next(it, '\n')) {
+		*bol = it->pos + 1;
+		const char *s = it->text + 1;
+		while (blanks && s < it->end && blank(*s))
+			s++;
+		if (s < it->end) {
+			it->pos += s - it->text;
+			it->text = s;
+			if (*s == '\n')
+				return true;
+			continue;
+		}
+		/* line continues in a subsequent piece */
+		while (text_iterator_byte_next(it, &c) && blanks && blank(c));
+		if (c == '\n')
+			return true;
 	}
+	return false;
+}
+
+/* Find the last newline before the iterator which is preceded by a line
+ * consisting only of blanks (if `blanks` is set) and another newline.
+ * On success the iterator points to the latter. */
+static bool line_blank_prev(Iterator *it, bool blanks) {
+	char c;
+	while (text_iterator_byte_find_prev(it, '\n')) {
+		const char *s = it->text;
+		while (blanks && s > it->start && blank(s[-1]))
+			s--;
+		if (s > it->start) {
+			it->pos -= it->text - s + 1;
+			it->text = s - 1;
+			if (*it->text == '\n')
+				return true;
+			continue;
+		}
+		/* line starts in a preceding piece */
+		c = '\0';
+		while (text_iterator_byte_prev(it, &c) && blanks && blank(c));
+		if (c == '\n')
+			return true;
+	}
+	return false;
+}
+
+size_t text_line_empty_next(Text *txt, size_t pos) {
+	size_t bol;
+	Iterator it = text_iterator_get(txt, pos);
+	if (line_blank_next(&it, false, &bol))
+		return bol;
 	return it.pos;
 }
 
 size_t text_line_empty_prev(Text *txt, size_t pos) {
-	char c;
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_byte_find_prev(&it, '\n')) {
-		if (text_iterator_byte_prev(&it, &c) && c == '\n')
-			return it.pos + 1;
-	}
+	if (line_blank_prev(&it, false))
+		return it.pos + 1;
 	return it.pos;
 }
 
 size_t text_line_blank_next(Text *txt, size_t pos) {
-	char c;
+	size_t bol;
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_byte_find_next(&it, '\n')) {
-		size_t n = it.pos;
-		while (text_iterator_byte_next(&it, &c) && blank(c));
-		if (c == '\n')
-			return n + 1;
-	}
+	if (line_blank_next(&it, true, &bol))
+		return bol;
 	return it.pos;
 }
 
 size_t text_line_blank_prev(Text *txt, size_t pos) {
-	char c;
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_byte_find_prev(&it, '\n')) {
-		while (text_iterator_byte_prev(&it, &c) && blank(c));
-		if (c == '\n')
-			return it.pos + 1;
-	}
+	if (line_blank_prev(&it, true))
+		return it.pos + 1;
 	return it.pos;
 }
 
@@ -530,44 +829,6 @@ size_t text_bracket_match(Text *txt, size_t pos, const Filerange *limits) {
 	return text_bracket_match_symbol(txt, pos, NULL, limits);
 }
 
-static size_t match_symbol(Text *txt, size_t pos, char search, int direction, const Filerange *limits) {
-	char c, current;
-	int count = 1;
-	bool instring = false;
-	Iterator it = text_iterator_get(txt, pos);
-	if (!text_iterator_byte_get(&it, &current))
-		return pos;
-	if (direction >= 0) { /* forward search */
-		while (text_iterator_byte_next(&it, &c)) {
-			if (limits && it.pos >= limits->end)
-				break;
-			if (c != current && c == '"')
-				instring = !instring;
-			if (!instring) {
-				if (c == search && --count == 0)
-					return it.pos;
-				else if (c == current)
-					count++;
-			}
-		}
-	} else { /* backwards */
-		while (text_iterator_byte_prev(&it, &c)) {
-			if (limits && it.pos < limits->start)
-				break;
-			if (c != current && c == '"')
-				instring = !instring;
-			if (!instring) {
-				if (c == search && --count == 0)
-					return it.pos;
-				else if (c == current)
-					count++;
-			}
-		}
-	}
-
-	return pos; /* no match found */
-}
-
 size_t text_bracket_match_symbol(Text *txt, size_t pos, const char *symbols, const Filerange *limits) {
 	int direction;
 	char search, current, c;
@@ -589,19 +850,16 @@ size_t text_bracket_match_symbol(Text *txt, size_t pos, const char *symbols, con
 	case '`':
 	case '\'':
 	{
-		/* prefer matches on the same line */
-		size_t fw = match_symbol(txt, pos, current, +1, limits);
-		size_t bw = match_symbol(txt, pos, current, -1, limits);
-		if (fw == pos)
-			return bw;
-		if (bw == pos)
+		size_t fw = brackets_next(txt, pos+1, current, true, limits ? limits->end : EPOS);
+		size_t bw = brackets_prev(txt, pos, current, true, limits ? limits->start : 0);
+		if (fw == EPOS)
+			return bw == EPOS ? pos : bw;
+		if (bw == EPOS)
 			return fw;
-		size_t line = text_lineno_by_pos(txt, pos);
-		size_t line_fw = text_lineno_by_pos(txt, fw);
-		size_t line_bw = text_lineno_by_pos(txt, bw);
-		if (line != line_fw)
+		/* prefer matches on the same line */
+		if (brackets_next(txt, pos, '\n', false, fw) != EPOS)
 			return bw;
-		if (line != line_bw)
+		if (brackets_prev(txt, pos, '\n', false, bw) != EPOS)
 			return fw;
 		direction = +1;
 		if (text_iterator_byte_next(&it, &c)) {
@@ -617,7 +875,12 @@ size_t text_bracket_match_symbol(Text *txt, size_t pos, const char *symbols, con
 		return pos;
 	}
 
-	return match_symbol(txt, pos, search, direction, limits);
+	size_t match;
+	if (direction >= 0)
+		match = brackets_next(txt, pos+1, search, true, limits ? limits->end : EPOS);
+	else
+		match = brackets_prev(txt, pos, search, true, limits ? limits->start : 0);
+	return match == EPOS ? pos : match;
 }
 
 size_t text_search_forward(Text *txt, size_t pos, Regex *regex) {
@@ -4,6 +4,7 @@
 #include <ctype.h>
 #include "text-motions.h"
 #include "text-objects.h"
+#include "text-internal.h"
 #include "text-util.h"
 #include "util.h"
 
@@ -213,7 +214,6 @@ Filerange text_object_paragraph_outer(Text *txt, size_t pos) {
 
 static Filerange text_object_bracket(Text *txt, size_t pos, char type) {
 	char c, open, close;
-	int opened = 1, closed = 1;
 	Filerange r = text_range_empty();
 
 	switch (type) {
@@ -227,35 +227,28 @@ static Filerange text_object_bracket(Text *txt, size_t pos, char type) {
 	default: return r;
 	}
 
-	Iterator it = text_iterator_get(txt, pos);
+	if (!text_byte_get(txt, pos, &c))
+		return r;
 
-	if (open == close && text_iterator_byte_get(&it, &c) && (c == '"' || c == '`' || c == '\'')) {
+	if (open == close && (c == '"' || c == '`' || c == '\'')) {
 		size_t match = text_bracket_match(txt, pos, NULL);
 		r.start = MIN(pos, match) + 1;
 		r.end = MAX(pos, match);
 		return r;
 	}
 
-	while (text_iterator_byte_get(&it, &c)) {
-		if (c == open && --opened == 0) {
-			r.start = it.pos + 1;
-			break;
-		} else if (c == close && it.pos != pos) {
-			opened++;
-		}
-		text_iterator_byte_prev(&it, NULL);
+	if (c == open) {
+		r.start = pos + 1;
+	} else {
+		size_t start = brackets_prev(txt, pos, open, false, 0);
+		if (start != EPOS)
+			r.start = start + 1;
 	}
 
-	it = text_iterator_get(txt, pos);
-	while (text_iterator_byte_get(&it, &c)) {
-		if (c == close && --closed == 0) {
-			r.end = it.pos;
-			break;
-		} else if (c == open && it.pos != pos) {
-			closed++;
-		}
-		text_iterator_byte_next(&it, NULL);
-	}
+	if (c == close)
+		r.end = pos;
+	else
+		r.end = brackets_next(txt, pos+1, close, false, EPOS);
 
 	if (!text_range_valid(&r))
 		return text_range_empty();
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+#include "text.h"
+#include "text-internal.h"
+#include "text-motions.h"
+#include "array.h"
+#include "buffer.h"
+#include "map.h"
+#include "util.h"
+
+/* The text is divided into chunks of roughly WORDS_CHUNK_SIZE bytes, each
+ * ending after a byte which can not be part of a word. Hence no word spans
+ * multiple chunks. For every chunk the distinct words it contains are
+ * recorded together with their number of occurrences, the sum over all
+ * chunks is kept in a crit-bit tree supporting ordered prefix queries.
+ *
+ * A modification merges all chunks it touches into one, and subtracts their
+ * words from the totals. Such dirty chunks are only rescanned upon the next
+ * query. Initially, the whole text forms one dirty chunk.
+ */
+#define WORDS_CHUNK_SIZE (1 << 14)
+
+typedef struct {
+	size_t count;              /* occurrences in the whole text */
+	size_t gen, ref;           /* index into the references of the chunk last scanned */
+	char word[];
+} Word;
+
+typedef struct {
+	Word *word;
+	size_t count;              /* occurrences within the chunk */
+} WordRef;
+
+typedef struct {
+	size_t len;                /* length in bytes */
+	bool dirty;                /* whether it needs to be rescanned */
+	Array refs;                /* WordRef, distinct words contained in the chunk */
+} WordChunk;
+
+struct WordIndex {
+	Map *words;                /* Word, keyed by itself */
+	Array chunks;              /* WordChunk, consecutive starting from position zero */
+	bool built;                /* whether chunks cover the text */
+	size_t gen;                /* number of chunks scanned so far */
+	Buffer buf;                /* word being scanned */
+};
+
+static bool wordchar(unsigned char c) {
+	static bool init, table[256];
+	if (!init) {
+		for (int i = 0; i < 256; i++)
+			table[i] = !is_word_boundary(i);
+		init = true;
+	}
+	return table[c];
+}
+
+WordIndex *words_new(void) {
+	WordIndex *idx = calloc(1, sizeof *idx);
+	if (!idx)
+		return NULL;
+	if (!(idx->words = map_new())) {
+		free(idx);
+		return NULL;
+	}
+	array_init_sized(&idx->chunks, sizeof(WordChunk));
+	buffer_init(&idx->buf);
+	return idx;
+}
+
+static void chunk_release(WordIndex *idx, WordChunk *chunk) {
+	for (size_t i = 0, len = array_length(&chunk->refs); i < len; i++) {
+		WordRef *ref = array_get(&chunk->refs, i);
+		Word *w = ref->word;
+		if ((w->count -= ref->count) == 0) {
+			map_delete(idx->words, w->word);
+			free(w);
+		}
+	}
+	array_release(&chunk->refs);
+}
+
+void words_free(WordIndex *idx) {
+	if (!idx)
+		return;
+	for (size_t i = 0, len = array_length(&idx->chunks); i < len; i++)
+		array_release(&((WordChunk*)array_get(&idx->chunks, i))->refs);
+	array_release(&idx->chunks);
+	map_free_full(idx->words);
+	buffer_release(&idx->buf);
+	free(idx);
+}
+
+void words_change(WordIndex *idx, size_t pos, size_t del, size_t len) {
+	if (!idx || !idx->built)
+		return;
+	size_t count = array_length(&idx->chunks);
+	if (count == 0) {
+		WordChunk chunk = { .len = len, .dirty = true };
+		array_init_sized(&chunk.refs, sizeof(WordRef));
+		array_add(&idx->chunks, &chunk);
+		return;
+	}
+	/* find the chunks containing the bytes adjacent to the modified range,
+	 * as words within them might now extend into it */
+	size_t first = pos > 0 ? pos - 1 : 0, last = pos + del;
+	size_t start = 0, a = count - 1, b = count - 1, merged = 0;
+	for (size_t i = 0; i < count; i++) {
+		WordChunk *chunk = array_get(&idx->chunks, i);
+		if (a == count - 1 && first < start + chunk->len)
+			a = i;
+		if (last < start + chunk->len) {
+			b = i;
+			break;
+		}
+		start += chunk->len;
+	}
+	if (b < a)
+		b = a;
+	for (size_t i = a; i <= b; i++) {
+		WordChunk *chunk = array_get(&idx->chunks, i);
+		merged += chunk->len;
+		chunk_release(idx, chunk);
+	}
+	WordChunk *chunk = array_get(&idx->chunks, a);
+	chunk->len = merged - del + len;
+	chunk->dirty = true;
+	array_init_sized(&chunk->refs, sizeof(WordRef));
+	for (size_t i = b + 1; i < count; i++)
+		array_set(&idx->chunks, a + 1 + i - (b + 1), array_get(&idx->chunks, i));
+	array_truncate(&idx->chunks, count - (b - a));
+}
+
+static bool word_add(WordIndex *idx, WordChunk *chunk) {
+	if (!buffer_terminate(&idx->buf))
+		return false;
+	const char *s = buffer_content(&idx->buf);
+	Word *w = map_get(idx->words, s);
+	if (!w) {
+		size_t len = buffer_length(&idx->buf);
+		if (!(w = calloc(1, sizeof *w + len + 1)))
+			return false;
+		memcpy(w->word, s, len + 1);
+		if (!map_put(idx->words, w->word, w)) {
+			free(w);
+			return false;
+		}
+	}
+	w->count++;
+	if (w->gen == idx->gen) {
+		WordRef *ref = array_get(&chunk->refs, w->ref);
+		ref->count++;
+	} else {
+		WordRef ref = { .word = w, .count = 1 };
+		w->gen = idx->gen;
+		w->ref = array_length(&chunk->refs);
+		if (!array_add(&chunk->refs, &ref)) {
+			w->count--;
+			w->gen = 0;
+			return false;
+		}
+	}
+	buffer_clear(&idx->buf);
+	return true;
+}
+
+/* new chunks remain marked as dirty until the update is complete */
+static WordChunk *chunk_add(WordIndex *idx, Array *chunks) {
+	WordChunk chunk = { .dirty = true };
+	array_init_sized(&chunk.refs, sizeof(WordRef));
+	if (!array_add(chunks, &chunk))
+		return NULL;
+	idx->gen++;
+	return array_peek(chunks);
+}
+
+/* scan the range [pos, pos+len) and append the resulting chunks */
+static bool chunks_scan(WordIndex *idx, Text *txt, size_t pos, size_t len, Array *chunks) {
+	WordChunk *chunk = NULL;
+	buffer_clear(&idx->buf);
+	for (Iterator it = text_iterator_get(txt, pos);
+	     len > 0 && text_iterator_valid(&it);
+	     text_iterator_next(&it)) {
+		const char *s = it.text, *end = s + MIN(len, (size_t)(it.end - it.text));
+		len -= end - s;
+		while (s < end) {
+			if (!chunk && !(chunk = chunk_add(idx, chunks)))
+				return false;
+			const char *start = s;
+			if (wordchar(*s)) {
+				while (s < end && wordchar(*s))
+					s++;
+				if (!buffer_append(&idx->buf, start, s - start))
+					return false;
+			} else {
+				if (buffer_length(&idx->buf) > 0 && !word_add(idx, chunk))
+					return false;
+				while (s < end && !wordchar(*s))
+					s++;
+			}
+			chunk->len += s - start;
+			if (chunk->len >= WORDS_CHUNK_SIZE && !wordchar(s[-1]))
+				chunk = NULL;
+		}
+	}
+	/* the range ends at EOF or after a non-word byte */
+	if (buffer_length(&idx->buf) > 0)
+		return word_add(idx, chunk);
+	return true;
+}
+
+/* rescan all dirty chunks */
+static bool words_update(WordIndex *idx, Text *txt) {
+	size_t count = array_length(&idx->chunks), pos = 0;
+	if (!idx->built) {
+		idx->built = true;
+		words_change(idx, 0, 0, text_size(txt));
+		count = array_length(&idx->chunks);
+	}
+	size_t i;
+	for (i = 0; i < count; i++) {
+		WordChunk *chunk = array_get(&idx->chunks, i);
+		if (chunk->dirty)
+			break;
+	}
+	if (i == count)
+		return true;
+
+	Array chunks;
+	array_init_sized(&chunks, sizeof(WordChunk));
+	for (i = 0; i < count; i++) {
+		WordChunk *chunk = array_get(&idx->chunks, i);
+		if (chunk->dirty) {
+			if (!chunks_scan(idx, txt, pos, chunk->len, &chunks))
+				goto err;
+		} else if (!array_add(&chunks, chunk)) {
+			goto err;
+		}
+		pos += chunk->len;
+	}
+	for (i = 0; i < count; i++) {
+		WordChunk *chunk = array_get(&idx->chunks, i);
+		if (chunk->dirty)
+			array_release(&chunk->refs);
+	}
+	array_release(&idx->chunks);
+	idx->chunks = chunks;
+	for (i = 0, count = array_length(&chunks); i < count; i++)
+		((WordChunk*)array_get(&chunks, i))->dirty = false;
+	return true;
+err:
+	/* undo the contributions of the new chunks, clean ones are still owned by the old array */
+	for (i = 0, count = array_length(&chunks); i < count; i++) {
+		WordChunk *chunk = array_get(&chunks, i);
+		if (chunk->dirty)
+			chunk_release(idx, chunk);
+	}
+	array_release(&chunks);
+	return false;
+}
+
+typedef struct {
+	bool (*handle)(const char *word, size_t count, void *data);
+	void *data;
+} WordsIterate;
+
+static bool words_iterate(const char *key, void *value, void *data) {
+	WordsIterate *iter = data;
+	Word *w = value;
+	return iter->handle(w->word, w->count, iter->data);
+}
+
+bool text_words(Text *txt, const char *prefix, bool (*handle)(const char *word, size_t count, void *data), void *data) {
+	WordIndex *idx = text_words_index(txt);
+	if (!idx || !words_update(idx, txt))
+		return false;
+	WordsIterate iter = { handle, data };
+	map_iterate(map_prefix(idx->words, prefix ? prefix : ""), words_iterate, &iter);
+	return true;
+}
@@ -74,6 +74,8 @@ struct Revision {
 	Revision *later;        /* the next Revision, chronologically */
 	time_t time;            /* when the first change of this revision was performed */
 	size_t seq;             /* a unique, strictly increasing identifier */
+	size_t size;            /* number of bytes removed by the changes, set by text_snapshot */
+	bool discard;           /* marks unreachable revisions during history compaction */
 };
 
 typedef struct {
@@ -81,6 +83,33 @@ typedef struct {
 	size_t lineno;          /* line number in file i.e. number of '\n' in [0, pos) */
 } LineCache;
 
+/* A contiguous part of the file content on disk, see saved_content_update */
+typedef struct {
+	const char *data;       /* piece data which was written to disk */
+	size_t len;             /* length in bytes */
+	size_t offset;          /* absolute position within the file */
+} SavedChunk;
+
+/* Data copied by text_defragment, used to translate marks referring to either copy */
+typedef struct {
+	const char *from;       /* original piece data */
+	const char *to;         /* its copy within a coalesced piece */
+	size_t len;             /* length in bytes */
+} Relocation;
+
+/* Part of a TextSlice, holds a reference to the block storing its data */
+typedef struct {
+	Block *block;           /* block kept alive while the slice exists */
+	const char *data;       /* pointer into it */
+	size_t len;             /* length in bytes */
+} SliceChunk;
+
+struct TextSlice {
+	Array chunks;           /* SliceChunk, in text order */
+	size_t size;            /* sum of their lengths */
+	Text *txt;              /* text the slice was taken from, NULL once it was freed */
+};
+
 /* The main struct holding all information of a given file */
 struct Text {
 	Array blocks;           /* blocks which hold text content */
@@ -94,10 +123,55 @@ struct Text {
 	size_t size;            /* current file content size in bytes */
 	struct stat info;       /* stat as probed at load time */
 	LineCache lines;        /* mapping between absolute pos in bytes and logical line breaks */
+	Array saved_content;    /* chunks making up the file content described by info, ordered by offset */
+	Array saved_index;      /* same chunks ordered by their data address */
+	bool saved_content_valid; /* whether saved_content reflects the file on disk */
+	Journal *journal;       /* records modifications for crash recovery, NULL if disabled */
+	BracketIndex *brackets; /* nesting depths of brackets and quotes, NULL until first used */
+	ColumnCache *columns;   /* column offsets within long lines, NULL until first used */
+	WordIndex *words;       /* distinct words and their occurrences, NULL until first used */
+	size_t revisions;       /* number of revisions in the undo tree, except its root */
+	size_t history_size;    /* sum of their sizes i.e. bytes removed by them */
+	size_t history_garbage; /* bytes of pieces freed since unused blocks were last released */
+	size_t max_revisions;   /* history limits, see text_history_limit, zero if unlimited */
+	size_t max_history_size;
+	size_t max_history_memory; /* history data kept in memory, see text_history_page */
+	size_t history_paged;   /* history_size when data was last paged out */
+	char *page_dir;         /* directory of the page file, NULL for the default */
+	int page_fd;            /* unlinked file holding paged out data, -1 if none */
+	off_t page_size;        /* its size */
+	Array paged;            /* Filerange, addresses mapped from the page file */
+	Array retired;          /* blocks which are no longer used, see block_retire */
+	Array slices;           /* TextSlice taken from the text which are still alive */
+	size_t pieces_allocated; /* number of pieces allocated so far */
+	size_t defrag_allocated; /* its value when fragmentation was last checked */
+	Array relocations;      /* Relocation, data moved by text_defragment ordered by source */
+	Array relocations_rev;  /* same relocations ordered by destination */
+	Piece *lookup;          /* piece preceding the most recent modification, or NULL */
+	size_t lookup_pos;      /* its absolute position, lookups beyond it start there */
 };
 
+/* Unused blocks are looked for once pieces referencing this many bytes were
+ * discarded by a history compaction. */
+#define HISTORY_GARBAGE_SIZE (1 << 20)
+
+/* Adjacent pieces shorter than DEFRAG_PIECE_SIZE are coalesced by text_defragment
+ * into a new piece of at most DEFRAG_MAX_SIZE bytes. Unless forced, this is done
+ * once DEFRAG_MIN_PIECES pieces were allocated since the last check and at least
+ * as many are eligible. */
+#define DEFRAG_PIECE_SIZE 256
+#define DEFRAG_MAX_SIZE (1 << 16)
+#define DEFRAG_MIN_PIECES 1024
+/* Repeated insertions of data at least this large are represented by pieces
+ * referring to a single copy, shorter ones are stored contiguously. */
+#define REPEAT_PIECE_SIZE (1 << 12)
+/* Maximal number of relocations followed when looking up a mark */
+#define MARK_RELOCATIONS_MAX 2
+
 /* block management */
 static const char *block_store(Text*, const char *data, size_t len);
+static int block_cmp(const void *a, const void *b);
+static size_t blocks_find(const Array *blocks, const char *data);
 /* cache layer */
 static void cache_piece(Text *txt, Piece *p);
 static bool cache_contains(Text *txt, Piece *p);
@@ -109,6 +183,8 @@ static void piece_free(Piece *p);
 static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, size_t len);
 static Location piece_get_intern(Text *txt, size_t pos);
 static Location piece_get_extern(const Text *txt, size_t pos);
+static bool piece_insert(Text *txt, Location loc, size_t pos, const char *data, size_t len);
+static bool piece_insert_stored(Text *txt, size_t pos, const char *data, size_t len);
 /* span management */
 static void span_init(Span *span, Piece *start, Piece *end);
 static void span_swap(Text *txt, Span *old, Span *new);
@@ -118,14 +194,22 @@ static void change_free(Change *c);
 /* revision management */
 static Revision *revision_alloc(Text *txt);
 static void revision_free(Revision *rev);
+static size_t revision_size(const Revision *rev);
+static void history_compact(Text *txt);
+static void history_page(Text *txt);
 /* logical line counting cache */
 static void lineno_cache_invalidate(LineCache *cache);
 static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skiped);
 static size_t lines_count(Text *txt, size_t pos, size_t len);
+/* on disk content tracking */
+static void saved_content_update(Text *txt);
 
-/* stores the given data in a block, allocates a new one if necessary. returns
- * a pointer to the storage location or NULL if allocation failed. */
-static const char *block_store(Text *txt, const char *data, size_t len) {
+/* modification tracking for the crash recovery journal and position dependent caches */
+static void record_change(Text *txt, size_t pos, size_t del, const char *data, size_t len);
+static void record_swap(Text *txt, size_t pos, const Span *old, const Span *new);
+
+/* return a block with room for len more bytes, allocate one if necessary */
+static Block *block_reserve(Text *txt, size_t len) {
 	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
 	if (!blk || !block_capacity(blk, len)) {
 		blk = block_alloc(len);
@@ -136,13 +220,24 @@ static const char *block_store(Text *txt, const char *data, size_t len) {
 			return NULL;
 		}
 	}
+	return blk;
+}
+
+/* stores the given data in a block, allocates a new one if necessary. returns
+ * a pointer to the storage location or NULL if allocation failed. */
+static const char *block_store(Text *txt, const char *data, size_t len) {
+	Block *blk = block_reserve(txt, len);
+	if (!blk)
+		return NULL;
 	return block_append(blk, data, len);
 }
 
 /* cache the given piece if it is the most recently changed one */
 static void cache_piece(Text *txt, Piece *p) {
 	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
-	if (!blk || p->data < blk->data || p->data + p->len != blk->data + blk->len)
+	if (!blk || blk->type != BLOCK_TYPE_ANON)
+		return; /* mmap(2)-ed blocks are read only */
+	if (p->data < blk->data || p->data + p->len != blk->data + blk->len)
 		return;
 	txt->cache = p;
 }
@@ -239,6 +334,7 @@ static void span_swap(Text *txt, Span *old, Span *new) {
 	}
 	txt->size -= old->len;
 	txt->size += new->len;
+	txt->lookup = NULL;
 }
 
 /* Allocate a new revision and place it in the revision graph.
@@ -288,6 +384,7 @@ static Piece *piece_alloc(Text *txt) {
 	if (!p)
 		return NULL;
 	p->text = txt;
+	txt->pieces_allocated++;
 	p->global_next = txt->pieces;
 	if (txt->pieces)
 		txt->pieces->global_prev = p;
@@ -326,7 +423,12 @@ static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, siz
  */
 static Location piece_get_intern(Text *txt, size_t pos) {
 	size_t cur = 0;
-	for (Piece *p = &txt->begin; p->next; p = p->next) {
+	Piece *p = &txt->begin;
+	if (txt->lookup && txt->lookup_pos < pos) {
+		p = txt->lookup;
+		cur = txt->lookup_pos;
+	}
+	for (; p->next; p = p->next) {
 		if (cur <= pos && pos <= cur + p->len)
 			return (Location){ .piece = p, .off = pos - cur };
 		cur += p->len;
@@ -342,9 +444,13 @@ static Location piece_get_intern(Text *txt, size_t pos) {
  */
 static Location piece_get_extern(const Text *txt, size_t pos) {
 	size_t cur = 0;
-	Piece *p;
+	Piece *p = txt->begin.next;
+	if (txt->lookup && txt->lookup_pos < pos) {
+		p = txt->lookup;
+		cur = txt->lookup_pos;
+	}
 
-	for (p = txt->begin.next; p->next; p = p->next) {
+	for (; p->next; p = p->next) {
 		if (cur <= pos && pos < cur + p->len)
 			return (Location){ .piece = p, .off = pos - cur };
 		cur += p->len;
@@ -356,6 +462,16 @@ static Location piece_get_extern(const Text *txt, size_t pos) {
 	return (Location){ 0 };
 }
 
+/* Remember the piece preceding the one at loc, corresponding to position pos.
+ * It is not affected by a modification at pos, subsequent lookups of later
+ * positions start from there. Makes ordered sequences of changes, as issued
+ * for multiple selections, linear instead of quadratic. */
+static void lookup_update(Text *txt, Location loc, size_t pos) {
+	Piece *prev = loc.piece->prev;
+	txt->lookup = prev;
+	txt->lookup_pos = prev ? pos - loc.off - prev->len : 0;
+}
+
 /* allocate a new change, associate it with current revision or a newly
  * allocated one if none exists. */
 static Change *change_alloc(Text *txt, size_t pos) {
@@ -426,14 +542,24 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 	if (!p)
 		return false;
 	size_t off = loc.off;
-	if (cache_insert(txt, p, off, data, len))
+	if (cache_insert(txt, p, off, data, len)) {
+		record_change(txt, pos, 0, data, len);
+		lookup_update(txt, loc, pos);
 		return true;
+	}
 
-	Change *c = change_alloc(txt, pos);
-	if (!c)
+	if (!(data = block_store(txt, data, len)) || !piece_insert(txt, loc, pos, data, len))
 		return false;
+	lookup_update(txt, loc, pos);
+	return true;
+}
 
-	if (!(data = block_store(txt, data, len)))
+/* insert data, which is already stored in one of the blocks, at the given location */
+static bool piece_insert(Text *txt, Location loc, size_t pos, const char *data, size_t len) {
+	Piece *p = loc.piece;
+	size_t off = loc.off;
+	Change *c = change_alloc(txt, pos);
+	if (!c)
 		return false;
 
 	Piece *new = NULL;
@@ -467,13 +593,26 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 
 	cache_piece(txt, new);
 	span_swap(txt, &c->old, &c->new);
+	record_change(txt, pos, 0, data, len);
 	return true;
 }
 
+/* insert data, which is already stored in one of the blocks, at the given position */
+static bool piece_insert_stored(Text *txt, size_t pos, const char *data, size_t len) {
+	if (pos < txt->lines.pos)
+		lineno_cache_invalidate(&txt->lines);
+	Location loc = piece_get_intern(txt, pos);
+	return loc.piece && piece_insert(txt, loc, pos, data, len);
+}
+
 static size_t revision_undo(Text *txt, Revision *rev) {
 	size_t pos = EPOS;
 	for (Change *c = rev->change; c; c = c->next) {
 		span_swap(txt, &c->new, &c->old);
+		/* changes at EPOS only rearrange pieces, see text_defragment */
+		if (c->pos == EPOS)
+			continue;
+		record_swap(txt, c->pos, &c->new, &c->old);
 		pos = c->pos;
 	}
 	return pos;
@@ -486,6 +625,9 @@ static size_t revision_redo(Text *txt, Revision *rev) {
 		c = c->next;
 	for ( ; c; c = c->prev) {
 		span_swap(txt, &c->old, &c->new);
+		if (c->pos == EPOS)
+			continue;
+		record_swap(txt, c->pos, &c->old, &c->new);
 		pos = c->pos;
 		if (c->new.len > c->old.len)
 			pos += c->new.len - c->old.len;
@@ -585,15 +727,471 @@ time_t text_state(const Text *txt) {
 	return txt->history->time;
 }
 
+/* length of the leading (or trailing if backward is set) part of the
+ * spans which references the same piece data in both of them */
+static size_t span_common(const Span *a, const Span *b, bool backward) {
+	size_t len = 0, aoff = 0, boff = 0;
+	Piece *p = a->len ? (backward ? a->end : a->start) : NULL;
+	Piece *q = b->len ? (backward ? b->end : b->start) : NULL;
+	Piece *pend = backward ? a->start : a->end;
+	Piece *qend = backward ? b->start : b->end;
+	while (p && q) {
+		if (aoff == p->len) {
+			p = p == pend ? NULL : (backward ? p->prev : p->next);
+			aoff = 0;
+		} else if (boff == q->len) {
+			q = q == qend ? NULL : (backward ? q->prev : q->next);
+			boff = 0;
+		} else {
+			const char *x = backward ? p->data + p->len - aoff : p->data + aoff;
+			const char *y = backward ? q->data + q->len - boff : q->data + boff;
+			if (x != y)
+				break;
+			size_t n = MIN(p->len - aoff, q->len - boff);
+			aoff += n;
+			boff += n;
+			len += n;
+		}
+	}
+	return len;
+}
+
+/* determine the part of the text modified by replacing the old span with
+ * the new one. parts which are shared among them (because a piece was split
+ * at the change position) are not considered modified: after the first
+ * prefix bytes, del bytes are removed and len bytes are inserted */
+static void span_diff(const Span *old, const Span *new, size_t *prefix, size_t *del, size_t *len) {
+	*prefix = span_common(old, new, false);
+	size_t suffix = span_common(old, new, true);
+	size_t max = MIN(old->len, new->len) - *prefix;
+	if (suffix > max)
+		suffix = max;
+	*del = old->len - *prefix - suffix;
+	*len = new->len - *prefix - suffix;
+}
+
+/* record the deletion of del bytes at pos followed by an insertion of data */
+static void record_change(Text *txt, size_t pos, size_t del, const char *data, size_t len) {
+	if (txt->brackets)
+		brackets_invalidate(txt->brackets, pos);
+	if (txt->columns)
+		columns_invalidate(txt->columns, pos);
+	if (txt->words)
+		words_change(txt->words, pos, del, len);
+	if (txt->journal)
+		journal_change(txt->journal, pos, del, data, len);
+}
+
+/* record that the old span was replaced by the new one at position pos */
+static void record_swap(Text *txt, size_t pos, const Span *old, const Span *new) {
+	if (txt->brackets)
+		brackets_invalidate(txt->brackets, pos);
+	if (txt->columns)
+		columns_invalidate(txt->columns, pos);
+	if (!txt->journal && !txt->words)
+		return;
+	size_t skip, del, rem;
+	span_diff(old, new, &skip, &del, &rem);
+	if (txt->words)
+		words_change(txt->words, pos, del, rem);
+	if (!txt->journal)
+		return;
+	for (Piece *p = new->start; rem > 0 && p; p = p->next) {
+		if (skip >= p->len) {
+			skip -= p->len;
+			continue;
+		}
+		size_t len = MIN(p->len - skip, rem);
+		journal_change(txt->journal, pos, del, p->data + skip, len);
+		pos += len;
+		rem -= len;
+		skip = del = 0;
+	}
+	if (del > 0)
+		journal_change(txt->journal, pos, del, NULL, 0);
+}
+
+BracketIndex *text_brackets(Text *txt) {
+	if (!txt->brackets)
+		txt->brackets = brackets_new();
+	return txt->brackets;
+}
+
+ColumnCache *text_columns(Text *txt) {
+	if (!txt->columns)
+		txt->columns = columns_new();
+	return txt->columns;
+}
+
+WordIndex *text_words_index(Text *txt) {
+	if (!txt->words)
+		txt->words = words_new();
+	return txt->words;
+}
+
+bool text_journal_open(Text *txt, const char *filename) {
+	if (txt->journal)
+		return journal_restart(txt->journal, &txt->info);
+	return (txt->journal = journal_open(filename, &txt->info));
+}
+
+bool text_journal_recover(Text *txt, const char *filename) {
+	if (txt->journal) {
+		errno = EBUSY;
+		return false;
+	}
+	return (txt->journal = journal_recover(txt, filename));
+}
+
+bool text_journal_pending(const Text *txt) {
+	return txt->journal && journal_pending(txt->journal);
+}
+
+bool text_journal_sync(Text *txt) {
+	return !txt->journal || journal_checkpoint(txt->journal, txt->size);
+}
+
+void text_journal_close(Text *txt) {
+	journal_free(txt->journal, true);
+	txt->journal = NULL;
+}
+
+/* Persistent undo history, see text_history_save. It starts with a header
+ * identifying the file content, followed by the revisions along the main
+ * branch starting from the current one. Every revision consists of its
+ * changes in the order in which they have to be undone, each immediately
+ * followed by the removed data. Inserted data is not stored, it is part of
+ * the file content respectively the data removed by a later revision. */
+typedef struct {
+	char magic[8];          /* HISTORY_MAGIC, without terminating NUL byte */
+	uint64_t dev, ino;      /* identity of the file */
+	uint64_t size;          /* size of the file content */
+	int64_t mtime;          /* modification time of said file content */
+	int64_t mtime_nsec;     /* its nanoseconds part */
+	uint64_t hash;          /* text_hash of said file content */
+} HistoryHeader;
+
+typedef struct {
+	int64_t time;           /* when the revision was created */
+	uint64_t changes;       /* number of changes following */
+} HistoryRevision;
+
+typedef struct {
+	uint64_t pos;           /* position of the change */
+	uint64_t del;           /* number of removed bytes following the record */
+	uint64_t len;           /* number of inserted bytes */
+} HistoryChange;
+
+#define HISTORY_MAGIC "vishist2"
+/* The file content is identified by its metadata and a FNV-1a hash of
+ * HISTORY_SAMPLES evenly spread samples of HISTORY_SAMPLE_SIZE bytes, such
+ * that neither storing nor restoring the history reads large files as a whole. */
+#define HISTORY_SAMPLES 16
+#define HISTORY_SAMPLE_SIZE (1 << 12)
+
+static uint64_t text_hash(const Text *txt) {
+	char buf[HISTORY_SAMPLE_SIZE];
+	uint64_t hash = 0xcbf29ce484222325;
+	size_t size = txt->size;
+	for (size_t i = 0; i < HISTORY_SAMPLES; i++) {
+		size_t pos = i * HISTORY_SAMPLE_SIZE;
+		if (size > HISTORY_SAMPLES * HISTORY_SAMPLE_SIZE)
+			pos = (size - HISTORY_SAMPLE_SIZE) / (HISTORY_SAMPLES - 1) * i;
+		size_t len = text_bytes_get(txt, pos, sizeof buf, buf);
+		for (size_t k = 0; k < len; k++)
+			hash = (hash ^ (unsigned char)buf[k]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+/* number of changes of a revision which actually modified the text */
+static uint64_t revision_changes(const Revision *rev) {
+	uint64_t count = 0;
+	for (Change *c = rev->change; c; c = c->next) {
+		if (c->pos == EPOS)
+			continue;
+		size_t prefix, del, len;
+		span_diff(&c->old, &c->new, &prefix, &del, &len);
+		if (del > 0 || len > 0)
+			count++;
+	}
+	return count;
+}
+
+/* write len bytes of the span content, starting skip bytes into it */
+static bool span_write(const Span *span, size_t skip, size_t len, FILE *fp) {
+	for (Piece *p = span->start; len > 0 && p; p = p->next) {
+		if (skip >= p->len) {
+			skip -= p->len;
+			continue;
+		}
+		size_t n = MIN(p->len - skip, len);
+		if (fwrite(p->data + skip, 1, n, fp) != n)
+			return false;
+		len -= n;
+		skip = 0;
+	}
+	return len == 0;
+}
+
+bool text_history_save(Text *txt, const char *filename) {
+	/* the existing history file might still be mapped, never modify it */
+	size_t namelen = strlen(filename) + sizeof ".XXXXXX";
+	char *tmpname = malloc(namelen);
+	if (!tmpname)
+		return false;
+	snprintf(tmpname, namelen, "%s.XXXXXX", filename);
+	FILE *fp = NULL;
+	int fd = mkstemp(tmpname);
+	if (fd == -1) {
+		free(tmpname);
+		return false;
+	}
+	if (!(fp = fdopen(fd, "w"))) {
+		close(fd);
+		goto err;
+	}
+
+	HistoryHeader hdr = {
+		.dev = txt->info.st_dev,
+		.ino = txt->info.st_ino,
+		.size = txt->info.st_size,
+		.mtime = txt->info.st_mtime,
+		.mtime_nsec = stat_mtime_nsec(&txt->info),
+		.hash = text_hash(txt),
+	};
+	memcpy(hdr.magic, HISTORY_MAGIC, sizeof hdr.magic);
+	errno = 0;
+	if (fwrite(&hdr, sizeof hdr, 1, fp) != 1)
+		goto err;
+	for (Revision *rev = txt->history; rev->prev; rev = rev->prev) {
+		HistoryRevision r = { .time = rev->time, .changes = revision_changes(rev) };
+		if (r.changes == 0)
+			continue;
+		if (fwrite(&r, sizeof r, 1, fp) != 1)
+			goto err;
+		for (Change *c = rev->change; c; c = c->next) {
+			if (c->pos == EPOS)
+				continue;
+			size_t prefix, del, len;
+			span_diff(&c->old, &c->new, &prefix, &del, &len);
+			if (del == 0 && len == 0)
+				continue;
+			HistoryChange hc = { .pos = c->pos, .del = del, .len = len };
+			if (fwrite(&hc, sizeof hc, 1, fp) != 1 ||
+			    !span_write(&c->old, prefix, del, fp))
+				goto err;
+		}
+	}
+
+	if (fflush(fp) == EOF || fsync(fd) == -1)
+		goto err;
+	int close_failed = fclose(fp);
+	fp = NULL;
+	if (close_failed == EOF || rename(tmpname, filename) == -1)
+		goto err;
+	free(tmpname);
+	return true;
+err: {
+		int saved_errno = errno ? errno : EIO;
+		if (fp)
+			fclose(fp);
+		unlink(tmpname);
+		free(tmpname);
+		errno = saved_errno;
+	}
+	return false;
+}
+
+/* copy a record out of the history file, advancing the offset */
+static bool history_read(const Block *blk, size_t *off, void *rec, size_t len) {
+	if (blk->len - *off < len)
+		return false;
+	memcpy(rec, blk->data + *off, len);
+	*off += len;
+	return true;
+}
+
+/* The revisions following root were created by undoing the stored ones
+ * i.e. they are in reverse chronological order. Invert all of them, such
+ * that root describes the current (oldest) state, and redo them. */
+static void history_reverse(Text *txt, Revision *root) {
+	Revision *first = root->next, *last = txt->history;
+	if (!first)
+		return;
+	for (Revision *rev = first; rev; rev = rev->next) {
+		Change *next, *c = rev->change;
+		rev->change = NULL;
+		for (; c; c = next) {
+			next = c->next;
+			Span old = c->old;
+			c->old = c->new;
+			c->new = old;
+			c->prev = NULL;
+			c->next = rev->change;
+			if (rev->change)
+				rev->change->prev = c;
+			rev->change = c;
+		}
+	}
+	for (Revision *a = first, *b = last; a != b && a->prev != b; a = a->next, b = b->prev) {
+		Change *c = a->change;
+		a->change = b->change;
+		b->change = c;
+		time_t time = a->time;
+		a->time = b->time;
+		b->time = time;
+	}
+	root->time = first->time;
+	txt->history = root;
+	for (Revision *rev = first; rev; rev = rev->next) {
+		revision_redo(txt, rev);
+		txt->history = rev;
+	}
+	lineno_cache_invalidate(&txt->lines);
+}
+
+/* return to the root revision and discard all later ones */
+static void history_truncate(Text *txt, Revision *root) {
+	text_snapshot(txt);
+	while (txt->history != root && txt->history->prev)
+		text_undo(txt);
+	for (Revision *later, *rev = root->later; rev; rev = later) {
+		later = rev->later;
+		revision_free(rev);
+	}
+	root->next = root->later = NULL;
+	txt->last_revision = root;
+	txt->revisions = 0;
+	txt->history_size = 0;
+	lineno_cache_invalidate(&txt->lines);
+}
+
+bool text_history_load(Text *txt, const char *filename) {
+	Revision *root = txt->history;
+	if (root->prev || root->next || txt->current_revision || txt->journal) {
+		errno = EBUSY;
+		return false;
+	}
+
+	Block *blk = NULL;
+	struct stat info;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &info) == -1)
+		goto err;
+	if (info.st_size < (off_t)sizeof(HistoryHeader)) {
+		errno = EINVAL;
+		goto err;
+	}
+	if (!(blk = block_mmap(info.st_size, fd, 0)))
+		goto err;
+	blk->type = BLOCK_TYPE_MMAP;
+	close(fd);
+	fd = -1;
+
+	HistoryHeader hdr;
+	size_t off = 0;
+	history_read(blk, &off, &hdr, sizeof hdr);
+	if (memcmp(hdr.magic, HISTORY_MAGIC, sizeof hdr.magic) != 0) {
+		/* histories written by other versions are treated as outdated */
+		bool version = memcmp(hdr.magic, HISTORY_MAGIC, sizeof hdr.magic - 1) == 0;
+		errno = version ? ESTALE : EINVAL;
+		goto err;
+	}
+	if (hdr.dev != (uint64_t)txt->info.st_dev || hdr.ino != (uint64_t)txt->info.st_ino ||
+	    hdr.size != (uint64_t)txt->info.st_size || hdr.size != txt->size ||
+	    hdr.mtime != (int64_t)txt->info.st_mtime ||
+	    hdr.mtime_nsec != (int64_t)stat_mtime_nsec(&txt->info) || hdr.hash != text_hash(txt)) {
+		errno = ESTALE;
+		goto err;
+	}
+
+	/* validate all records before modifying anything */
+	uint64_t size = txt->size;
+	while (off < blk->len) {
+		HistoryRevision rev;
+		if (!history_read(blk, &off, &rev, sizeof rev))
+			goto invalid;
+		for (uint64_t i = 0; i < rev.changes; i++) {
+			HistoryChange c;
+			if (!history_read(blk, &off, &c, sizeof c) || c.pos > size ||
+			    c.len > size - c.pos || c.del > blk->len - off)
+				goto invalid;
+			off += c.del;
+			size = size - c.len + c.del;
+		}
+	}
+
+	if (!array_add_ptr(&txt->blocks, blk))
+		goto err;
+	Block *data = blk;
+	blk = NULL;
+
+	/* limits are enforced once the history is complete */
+	size_t max_revisions = txt->max_revisions, max_size = txt->max_history_size;
+	txt->max_revisions = txt->max_history_size = 0;
+
+	/* undo stored revisions, the removed data is referenced from the mapping */
+	for (off = sizeof hdr; off < data->len; ) {
+		HistoryRevision rev;
+		history_read(data, &off, &rev, sizeof rev);
+		for (uint64_t i = 0; i < rev.changes; i++) {
+			HistoryChange c;
+			history_read(data, &off, &c, sizeof c);
+			if (!text_delete(txt, c.pos, c.len) ||
+			    (c.del > 0 && !piece_insert_stored(txt, c.pos, data->data + off, c.del))) {
+				int saved_errno = errno ? errno : ENOMEM;
+				history_truncate(txt, root);
+				txt->max_revisions = max_revisions;
+				txt->max_history_size = max_size;
+				errno = saved_errno;
+				return false;
+			}
+			off += c.del;
+		}
+		if (txt->current_revision)
+			txt->current_revision->time = rev.time;
+		text_snapshot(txt);
+	}
+
+	history_reverse(txt, root);
+	txt->saved_revision = txt->history;
+	txt->history_size = 0;
+	for (Revision *rev = root->next; rev; rev = rev->next)
+		txt->history_size += (rev->size = revision_size(rev));
+	text_history_limit(txt, max_revisions, max_size);
+	return true;
+invalid:
+	errno = EINVAL;
+err: {
+		int saved_errno = errno;
+		if (fd != -1)
+			close(fd);
+		block_free(blk);
+		errno = saved_errno;
+	}
+	return false;
+}
+
 Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod method) {
 	Text *txt = calloc(1, sizeof *txt);
 	if (!txt)
 		return NULL;
+	txt->page_fd = -1;
 	Piece *p = piece_alloc(txt);
 	if (!p)
 		goto out;
 	Block *block = NULL;
 	array_init(&txt->blocks);
+	array_init_sized(&txt->saved_content, sizeof(SavedChunk));
+	array_init_sized(&txt->saved_index, sizeof(SavedChunk));
+	array_init_sized(&txt->relocations, sizeof(Relocation));
+	array_init_sized(&txt->relocations_rev, sizeof(Relocation));
+	array_init_sized(&txt->paged, sizeof(Filerange));
+	array_init(&txt->retired);
+	array_init(&txt->slices);
 	lineno_cache_invalidate(&txt->lines);
 	if (filename) {
 		errno = 0;
@@ -618,6 +1216,8 @@ Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod me
 	change_alloc(txt, EPOS);
 	text_snapshot(txt);
 	txt->saved_revision = txt->history;
+	if (filename)
+		saved_content_update(txt);
 
 	return txt;
 out:
@@ -629,11 +1229,143 @@ struct stat text_stat(const Text *txt) {
 	return txt->info;
 }
 
-void text_saved(Text *txt, struct stat *meta) {
+void text_saved(Text *txt, struct stat *meta, bool complete) {
 	if (meta)
 		txt->info = *meta;
 	txt->saved_revision = txt->history;
 	text_snapshot(txt);
+	if (meta && complete)
+		saved_content_update(txt);
+	else
+		txt->saved_content_valid = false;
+}
+
+/* remember which pieces make up the file content on disk. because the
+ * data of a piece is never modified once it is part of a snapshot, the
+ * data pointers can later be compared to find changed regions. */
+static void saved_content_update(Text *txt) {
+	size_t offset = 0;
+	array_truncate(&txt->saved_content, 0);
+	array_truncate(&txt->saved_index, 0);
+	txt->saved_content_valid = false;
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		if (p->len == 0)
+			continue;
+		SavedChunk c = { .data = p->data, .len = p->len, .offset = offset };
+		if (!array_add(&txt->saved_content, &c))
+			return;
+		offset += p->len;
+	}
+	txt->saved_content_valid = true;
+}
+
+static int saved_chunk_cmp(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t)((const SavedChunk*)a)->data;
+	uintptr_t y = (uintptr_t)((const SavedChunk*)b)->data;
+	return x < y ? -1 : x > y;
+}
+
+size_t text_saved_offset(Text *txt, const char *data, size_t len, off_t *offset) {
+	*offset = -1;
+	if (!txt->saved_content_valid || len == 0)
+		return len;
+	Array *index = &txt->saved_index;
+	size_t count = array_length(&txt->saved_content);
+	if (array_length(index) != count) {
+		array_truncate(index, 0);
+		for (size_t i = 0; i < count; i++) {
+			if (!array_add(index, array_get(&txt->saved_content, i))) {
+				array_truncate(index, 0);
+				return len;
+			}
+		}
+		array_sort(index, saved_chunk_cmp);
+	}
+
+	/* find the last chunk starting at or before data */
+	uintptr_t addr = (uintptr_t)data;
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		SavedChunk *c = array_get(index, mid);
+		if ((uintptr_t)c->data <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0) {
+		SavedChunk *c = array_get(index, lo - 1);
+		uintptr_t start = (uintptr_t)c->data;
+		if (addr < start + c->len) {
+			*offset = c->offset + (addr - start);
+			return MIN(len, start + c->len - addr);
+		}
+	}
+	if (lo < count) {
+		SavedChunk *c = array_get(index, lo);
+		return MIN(len, (uintptr_t)c->data - addr);
+	}
+	return len;
+}
+
+static bool saved_range_add(Array *ranges, size_t start, size_t end) {
+	Filerange *last = array_peek(ranges);
+	if (last && last->end == start) {
+		last->end = end;
+		return true;
+	}
+	Filerange r = { .start = start, .end = end };
+	return array_add(ranges, &r);
+}
+
+bool text_saved_ranges(Text *txt, Array *ranges, size_t *saved_size, size_t limit) {
+	if (!txt->saved_content_valid)
+		return false;
+	array_truncate(ranges, 0);
+	size_t pos = 0, dirty = 0, idx = 0, off = 0;
+	size_t saved_len = array_length(&txt->saved_content);
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		const char *data = p->data;
+		size_t len = p->len;
+		while (len > 0) {
+			size_t n = len;
+			bool same = false;
+			if (idx < saved_len) {
+				SavedChunk *s = array_get(&txt->saved_content, idx);
+				n = MIN(n, s->len - off);
+				same = (data == s->data + off);
+				off += n;
+				if (off == s->len) {
+					idx++;
+					off = 0;
+				}
+			}
+			if (!same) {
+				dirty += n;
+				if (dirty > limit || !saved_range_add(ranges, pos, pos + n))
+					return false;
+			}
+			data += n;
+			pos += n;
+			len -= n;
+		}
+	}
+
+	SavedChunk *last = array_peek(&txt->saved_content);
+	*saved_size = last ? last->offset + last->len : 0;
+	return true;
+}
+
+bool text_replace_block(Text *txt, size_t pos, size_t len, Block *blk) {
+	if (blk && !array_add_ptr(&txt->blocks, blk)) {
+		block_free(blk);
+		return false;
+	}
+	bool ret = text_delete(txt, pos, len);
+	if (ret && blk && blk->len > 0)
+		ret = piece_insert_stored(txt, pos, blk->data, blk->len);
+	return ret;
 }
 
 Block *text_block_mmaped(Text *txt) {
@@ -671,8 +1403,11 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	if (!p)
 		return false;
 	size_t off = loc.off;
-	if (cache_delete(txt, p, off, len))
+	if (cache_delete(txt, p, off, len)) {
+		record_change(txt, pos, len, NULL, 0);
+		lookup_update(txt, loc, pos);
 		return true;
+	}
 	Change *c = change_alloc(txt, pos);
 	if (!c)
 		return false;
@@ -737,6 +1472,115 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	span_init(&c->new, new_start, new_end);
 	span_init(&c->old, start, end);
 	span_swap(txt, &c->old, &c->new);
+	record_change(txt, pos, len, NULL, 0);
+	lookup_update(txt, loc, pos);
+	return true;
+}
+
+/* append a piece referring to data to the span being built from first to last */
+static bool span_append(Text *txt, Piece **first, Piece **last, const char *data, size_t len) {
+	if (len == 0)
+		return true;
+	Piece *p = piece_alloc(txt);
+	if (!p)
+		return false;
+	piece_init(p, *last, NULL, data, len);
+	if (*last)
+		(*last)->next = p;
+	else
+		*first = p;
+	*last = p;
+	return true;
+}
+
+/* All modifications are expressed as one new span replacing the pieces from
+ * the first to the last affected position. Unmodified text in between keeps
+ * referring to its original storage, marks within it remain valid. Inserted
+ * data is stored once per distinct source buffer. */
+bool text_edit(Text *txt, const TextEdit *edits, size_t count) {
+	size_t end = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (edits[i].pos < end || !addu(edits[i].pos, edits[i].del, &end) || end > txt->size) {
+			errno = EINVAL;
+			return false;
+		}
+	}
+	while (count > 0 && edits[count-1].del == 0 && edits[count-1].len == 0)
+		count--;
+	while (count > 0 && edits[0].del == 0 && edits[0].len == 0) {
+		edits++;
+		count--;
+	}
+	if (count == 0)
+		return true;
+
+	size_t pos = edits[0].pos;
+	if (pos < txt->lines.pos)
+		lineno_cache_invalidate(&txt->lines);
+	Location loc = piece_get_intern(txt, pos);
+	if (!loc.piece)
+		return false;
+	Change *c = change_alloc(txt, pos);
+	if (!c)
+		return false;
+
+	Piece *first = NULL, *last = NULL;
+	Piece *start = loc.piece, *p = start; /* first replaced and current piece */
+	size_t off = loc.off, cur = pos;
+	if (off == p->len) {
+		start = p = p->next;
+		off = 0;
+	} else if (!span_append(txt, &first, &last, p->data, off)) {
+		return false;
+	}
+
+	const char *src = NULL, *stored = NULL;
+	size_t stored_len = 0;
+	for (size_t i = 0; i < count; i++) {
+		const TextEdit *e = &edits[i];
+		for (size_t len; cur < e->pos; cur += len, off += len) {
+			while (off == p->len) {
+				p = p->next;
+				off = 0;
+			}
+			len = MIN(p->len - off, e->pos - cur);
+			if (!span_append(txt, &first, &last, p->data + off, len))
+				return false;
+		}
+		if (e->len > 0) {
+			if (e->data != src || e->len > stored_len) {
+				if (!(stored = block_store(txt, e->data, e->len)))
+					return false;
+				src = e->data;
+				stored_len = e->len;
+			}
+			if (!span_append(txt, &first, &last, stored, e->len))
+				return false;
+		}
+		for (size_t len, del = e->del; del > 0; cur += len, off += len, del -= len) {
+			while (off == p->len) {
+				p = p->next;
+				off = 0;
+			}
+			len = MIN(p->len - off, del);
+		}
+	}
+
+	Piece *stop = p; /* last replaced piece, if any */
+	if (off == 0)
+		stop = p == start ? NULL : p->prev;
+	else if (!span_append(txt, &first, &last, p->data + off, p->len - off))
+		return false;
+
+	if (first) {
+		first->prev = start->prev;
+		last->next = stop ? stop->next : start;
+	}
+	span_init(&c->new, first, last);
+	span_init(&c->old, stop ? start : NULL, stop);
+	span_swap(txt, &c->old, &c->new);
+	record_swap(txt, pos, &c->old, &c->new);
+	lookup_update(txt, loc, pos);
 	return true;
 }
 
@@ -746,16 +1590,819 @@ bool text_delete_range(Text *txt, const Filerange *r) {
 	return text_delete(txt, r->start, text_range_size(r));
 }
 
+/* copy of the block array ordered by block_cmp, for use with blocks_find */
+static bool blocks_sorted(const Text *txt, Array *sorted) {
+	array_init(sorted);
+	if (!array_reserve(sorted, array_length(&txt->blocks)))
+		return false;
+	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++)
+		array_add_ptr(sorted, array_get_ptr(&txt->blocks, i));
+	array_sort(sorted, block_cmp);
+	return true;
+}
+
+TextSlice *text_slice_new(Text *txt, const Filerange *r) {
+	if (!text_range_valid(r) || r->end > txt->size) {
+		errno = EINVAL;
+		return NULL;
+	}
+	TextSlice *slice = calloc(1, sizeof *slice);
+	if (!slice)
+		return NULL;
+	array_init_sized(&slice->chunks, sizeof(SliceChunk));
+	Array blocks;
+	if (!blocks_sorted(txt, &blocks))
+		goto err;
+	if (!array_add_ptr(&txt->slices, slice))
+		goto err;
+	slice->txt = txt;
+	/* the most recently modified piece is changed in place, stop doing so */
+	txt->cache = NULL;
+	Location loc = piece_get_extern(txt, r->start);
+	size_t off = loc.off, rem = text_range_size(r);
+	for (Piece *p = loc.piece; rem > 0 && p && p->data; p = p->next, off = 0) {
+		size_t len = MIN(p->len - off, rem);
+		const char *data = p->data + off;
+		rem -= len;
+		if (len == 0)
+			continue;
+		SliceChunk *last = array_peek(&slice->chunks);
+		if (last && last->data + last->len == data &&
+		    data < last->block->data + last->block->size) {
+			last->len += len;
+			continue;
+		}
+		size_t idx = blocks_find(&blocks, data);
+		if (idx == EPOS)
+			goto err;
+		SliceChunk chunk = { .block = array_get_ptr(&blocks, idx), .data = data, .len = len };
+		if (!array_add(&slice->chunks, &chunk))
+			goto err;
+		block_ref(chunk.block);
+	}
+	slice->size = text_range_size(r) - rem;
+	array_release(&blocks);
+	return slice;
+err:
+	array_release(&blocks);
+	text_slice_free(slice);
+	return NULL;
+}
+
+void text_slice_free(TextSlice *slice) {
+	if (!slice)
+		return;
+	for (size_t i = 0, len = slice->txt ? array_length(&slice->txt->slices) : 0; i < len; i++) {
+		if (array_get_ptr(&slice->txt->slices, i) == slice) {
+			array_remove(&slice->txt->slices, i);
+			break;
+		}
+	}
+	for (size_t i = 0, len = array_length(&slice->chunks); i < len; i++) {
+		SliceChunk *chunk = array_get(&slice->chunks, i);
+		block_free(chunk->block);
+	}
+	array_release(&slice->chunks);
+	free(slice);
+}
+
+size_t text_slice_size(const TextSlice *slice) {
+	return slice->size;
+}
+
+size_t text_slice_bytes_get(const TextSlice *slice, size_t pos, size_t len, char *buf) {
+	size_t rem = len;
+	for (size_t i = 0, count = array_length(&slice->chunks); i < count && rem > 0; i++) {
+		SliceChunk *chunk = array_get(&slice->chunks, i);
+		if (pos >= chunk->len) {
+			pos -= chunk->len;
+			continue;
+		}
+		size_t n = MIN(chunk->len - pos, rem);
+		memcpy(buf, chunk->data + pos, n);
+		buf += n;
+		rem -= n;
+		pos = 0;
+	}
+	return len - rem;
+}
+
+/* Store the chunks of the slice in the given array, taking a reference to all
+ * blocks holding their data which are not yet known. Data mmap(2)-ed from the
+ * file of another text is copied instead, such that it is detached from the
+ * file when that text is freed, see slices_detach. */
+static bool slice_import(Text *txt, const TextSlice *slice, Array *chunks) {
+	/* the first block is assumed to hold the original file content,
+	 * make sure it is not replaced by a foreign one */
+	if (array_length(&txt->blocks) == 0 && !block_reserve(txt, 0))
+		return false;
+	Array blocks;
+	if (!blocks_sorted(txt, &blocks))
+		return false;
+	bool ret = true;
+	for (size_t i = 0, len = array_length(&slice->chunks); ret && i < len; i++) {
+		SliceChunk chunk = *(SliceChunk*)array_get(&slice->chunks, i);
+		if (blocks_find(&blocks, chunk.data) != EPOS) {
+			ret = array_add(chunks, &chunk);
+		} else if (chunk.block->type == BLOCK_TYPE_MMAP_ORIG) {
+			txt->cache = NULL;
+			ret = (chunk.data = block_store(txt, chunk.data, chunk.len)) &&
+			      array_add(chunks, &chunk);
+		} else if ((ret = array_add_ptr(&txt->blocks, chunk.block) && array_add(chunks, &chunk))) {
+			block_ref(chunk.block);
+			array_release(&blocks);
+			ret = blocks_sorted(txt, &blocks);
+		}
+	}
+	array_release(&blocks);
+	return ret;
+}
+
+/* insert count repetitions of the chunks, which are already stored in one of
+ * the blocks, as a single change. same as piece_insert, but with a piece for
+ * each of them */
+static bool piece_insert_chunks(Text *txt, size_t pos, const SliceChunk *chunks, size_t n, size_t count) {
+	if (pos < txt->lines.pos)
+		lineno_cache_invalidate(&txt->lines);
+	Location loc = piece_get_intern(txt, pos);
+	Piece *p = loc.piece;
+	if (!p)
+		return false;
+	Change *c = change_alloc(txt, pos);
+	if (!c)
+		return false;
+
+	Piece *before = NULL, *after = NULL, *prev = p, *first = NULL, *last = NULL;
+	if (loc.off < p->len) {
+		if (!(before = piece_alloc(txt)) || !(after = piece_alloc(txt)))
+			return false;
+		prev = before;
+	}
+	for (size_t i = 0; i < count * n; i++) {
+		Piece *new = piece_alloc(txt);
+		if (!new)
+			return false;
+		piece_init(new, last ? last : prev, NULL, chunks[i % n].data, chunks[i % n].len);
+		if (last)
+			last->next = new;
+		else
+			first = new;
+		last = new;
+	}
+
+	if (before) {
+		piece_init(before, p->prev, first, p->data, loc.off);
+		piece_init(after, last, p->next, p->data + loc.off, p->len - loc.off);
+		last->next = after;
+		span_init(&c->new, before, after);
+		span_init(&c->old, p, p);
+	} else {
+		last->next = p->next;
+		span_init(&c->new, first, last);
+		span_init(&c->old, NULL, NULL);
+	}
+
+	span_swap(txt, &c->old, &c->new);
+	record_swap(txt, pos, &c->old, &c->new);
+	lookup_update(txt, loc, pos);
+	return true;
+}
+
+bool text_insert_slice(Text *txt, size_t pos, const TextSlice *slice, size_t count) {
+	size_t n = array_length(&slice->chunks);
+	if (n == 0 || count == 0)
+		return true;
+	if (pos > txt->size || count > SIZE_MAX / n) {
+		errno = EINVAL;
+		return false;
+	}
+	Array chunks;
+	array_init_sized(&chunks, sizeof(SliceChunk));
+	bool ret = slice_import(txt, slice, &chunks) &&
+	           piece_insert_chunks(txt, pos, array_get(&chunks, 0), n, count);
+	array_release(&chunks);
+	return ret;
+}
+
+bool text_insert_repeat(Text *txt, size_t pos, const char *data, size_t len, size_t count) {
+	if (len == 0 || count == 0)
+		return true;
+	if (pos > txt->size || len > SIZE_MAX / count) {
+		errno = EINVAL;
+		return false;
+	}
+	if (count == 1)
+		return text_insert(txt, pos, data, len);
+	if (len >= REPEAT_PIECE_SIZE) {
+		SliceChunk chunk = { .data = block_store(txt, data, len), .len = len };
+		return chunk.data && piece_insert_chunks(txt, pos, &chunk, 1, count);
+	}
+	size_t size = len * count;
+	Block *blk = block_reserve(txt, size);
+	if (!blk)
+		return false;
+	const char *stored = block_append(blk, data, len);
+	for (size_t i = 1; i < count; i++)
+		block_append(blk, data, len);
+	if (pos < txt->lines.pos)
+		lineno_cache_invalidate(&txt->lines);
+	Location loc = piece_get_intern(txt, pos);
+	if (!loc.piece || !piece_insert(txt, loc, pos, stored, size))
+		return false;
+	lookup_update(txt, loc, pos);
+	return true;
+}
+
 /* preserve the current text content such that it can be restored by
  * means of undo/redo operations */
 bool text_snapshot(Text *txt) {
-	if (txt->current_revision)
-		txt->last_revision = txt->current_revision;
+	Revision *rev = txt->current_revision;
 	txt->current_revision = NULL;
 	txt->cache = NULL;
+	if (rev) {
+		txt->last_revision = rev;
+		if (rev->prev) {
+			rev->size = revision_size(rev);
+			txt->revisions++;
+			txt->history_size += rev->size;
+		}
+		history_compact(txt);
+		history_page(txt);
+	}
+	return true;
+}
+
+/* number of bytes removed by a revision, which are only kept for undo */
+static size_t revision_size(const Revision *rev) {
+	size_t size = 0;
+	for (Change *c = rev->change; c; c = c->next) {
+		if (c->pos == EPOS)
+			continue;
+		size_t prefix, del, len;
+		span_diff(&c->old, &c->new, &prefix, &del, &len);
+		size += del;
+	}
+	return size;
+}
+
+/* free all pieces of a span which is no longer referenced */
+static void span_free(Text *txt, Span *span) {
+	for (Piece *next, *p = span->start; p; p = next) {
+		next = p == span->end ? NULL : p->next;
+		txt->history_garbage += p->len;
+		piece_free(p);
+	}
+}
+
+static int block_cmp(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t)(*(Block* const*)a)->data;
+	uintptr_t y = (uintptr_t)(*(Block* const*)b)->data;
+	return x < y ? -1 : x > y;
+}
+
+/* index of the block holding data in an array sorted by block_cmp, EPOS if none */
+static size_t blocks_find(const Array *blocks, const char *data) {
+	size_t lo = 0, hi = array_length(blocks);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Block *blk = array_get_ptr(blocks, mid);
+		if ((uintptr_t)data < (uintptr_t)blk->data)
+			hi = mid;
+		else if ((uintptr_t)data >= (uintptr_t)(blk->data + blk->size))
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return EPOS;
+}
+
+static int range_cmp(const void *a, const void *b) {
+	const Filerange *x = a, *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* sort ranges and coalesce overlapping or adjacent ones */
+static void ranges_merge(Array *ranges) {
+	array_sort(ranges, range_cmp);
+	size_t len = 0;
+	for (size_t i = 0; i < array_length(ranges); i++) {
+		Filerange *r = array_get(ranges, i), *prev = len ? array_get(ranges, len-1) : NULL;
+		if (prev && r->start <= prev->end)
+			prev->end = MAX(prev->end, r->end);
+		else
+			array_set(ranges, len++, r);
+	}
+	array_truncate(ranges, len);
+}
+
+/* index of the first of the sorted, disjoint ranges ending after addr */
+static size_t ranges_find(const Array *ranges, size_t addr) {
+	size_t lo = 0, hi = array_length(ranges);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Filerange *r = array_get(ranges, mid);
+		if (r->end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* whether len bytes at data overlap one of the sorted, disjoint ranges */
+static bool ranges_overlap(const Array *ranges, const char *data, size_t len) {
+	Filerange *r = array_get(ranges, ranges_find(ranges, (uintptr_t)data));
+	return r && r->start < (uintptr_t)(data + len);
+}
+
+/* whether len bytes at data are contained in one of the sorted, disjoint ranges */
+static bool ranges_cover(const Array *ranges, const char *data, size_t len) {
+	Filerange *r = array_get(ranges, ranges_find(ranges, (uintptr_t)data));
+	return r && r->start <= (uintptr_t)data && (uintptr_t)(data + len) <= r->end;
+}
+
+/* Forget about relocations which can no longer be followed. One is needed if
+ * its source or destination is referenced by a piece. Otherwise, a mark
+ * pointing into its destination might still be resolved by following it back
+ * to the source and from there to another copy, unless the destination was
+ * itself copied and thus has relocations of its own. */
+static void relocations_prune(Text *txt) {
+	if (array_length(&txt->relocations) == 0)
+		return;
+	Array used, sources;
+	array_init_sized(&used, sizeof(Filerange));
+	array_init_sized(&sources, sizeof(Filerange));
+	for (Piece *p = txt->pieces; p; p = p->global_next) {
+		Filerange r = { .start = (uintptr_t)p->data, .end = (uintptr_t)(p->data + p->len) };
+		if (p->len && !array_add(&used, &r))
+			goto out;
+	}
+	ranges_merge(&used);
+	/* sources of relocations which are needed in any case */
+	for (size_t i = 0; i < array_length(&txt->relocations); i++) {
+		Relocation *r = array_get(&txt->relocations, i);
+		Filerange from = { .start = (uintptr_t)r->from, .end = (uintptr_t)(r->from + r->len) };
+		if ((ranges_overlap(&used, r->from, r->len) || ranges_overlap(&used, r->to, r->len)) &&
+		    !array_add(&sources, &from))
+			goto out;
+	}
+	ranges_merge(&sources);
+	Array *arrays[] = { &txt->relocations, &txt->relocations_rev };
+	for (int i = 0; i < LENGTH(arrays); i++) {
+		size_t len = 0;
+		for (size_t k = 0; k < array_length(arrays[i]); k++) {
+			Relocation *r = array_get(arrays[i], k);
+			if (ranges_overlap(&used, r->from, r->len) || ranges_overlap(&used, r->to, r->len) ||
+			    (ranges_overlap(&sources, r->from, r->len) && !ranges_cover(&sources, r->to, r->len)))
+				array_set(arrays[i], len++, r);
+		}
+		array_truncate(arrays[i], len);
+	}
+out:
+	array_release(&used);
+	array_release(&sources);
+}
+
+/* forget about paged out data of a block which is about to be freed */
+static void paged_prune(Text *txt, Block *blk) {
+	size_t len = 0;
+	for (size_t i = 0; i < array_length(&txt->paged); i++) {
+		Filerange *r = array_get(&txt->paged, i);
+		if (r->start < (uintptr_t)blk->data || (uintptr_t)(blk->data + blk->size) <= r->start)
+			array_set(&txt->paged, len++, r);
+	}
+	array_truncate(&txt->paged, len);
+}
+
+/* release blocks whose data is no longer referenced by any piece. Their
+ * address ranges stay reserved, marks might still point into them */
+static void blocks_collect(Text *txt) {
+	txt->history_garbage = 0;
+	/* the first block holds the original file content, the last one is
+	 * still being filled. both are always kept */
+	size_t count = array_length(&txt->blocks);
+	if (count < 3)
+		return;
+	Array unused;
+	array_init(&unused);
+	for (size_t i = 1; i < count - 1; i++) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		/* blocks shared with a slice are kept until it is freed */
+		if (blk->size > 0 && blk->refs == 0 && !array_add_ptr(&unused, blk))
+			goto out;
+	}
+	array_sort(&unused, block_cmp);
+
+	for (Piece *p = txt->pieces; p && array_length(&unused) > 0; p = p->global_next) {
+		size_t idx = blocks_find(&unused, p->data);
+		if (idx != EPOS)
+			array_remove(&unused, idx);
+	}
+
+	size_t len = 0;
+	for (size_t i = 0; i < count; i++) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		if (blocks_find(&unused, blk->data) == EPOS)
+			array_set_ptr(&txt->blocks, len++, blk);
+	}
+	array_truncate(&txt->blocks, len);
+
+	for (size_t i = 0; i < array_length(&unused); i++) {
+		Block *blk = array_get_ptr(&unused, i);
+		/* the on disk content tracking must not match reused addresses */
+		for (size_t k = 0; txt->saved_content_valid && k < array_length(&txt->saved_content); k++) {
+			SavedChunk *c = array_get(&txt->saved_content, k);
+			if (blk->data <= c->data && c->data < blk->data + blk->size)
+				txt->saved_content_valid = false;
+		}
+		paged_prune(txt, blk);
+		if (!block_retire(blk) || !array_add_ptr(&txt->retired, blk))
+			block_free(blk);
+	}
+	relocations_prune(txt);
+out:
+	array_release(&unused);
+}
+
+/* Make base the root of the undo tree. All revisions preceding it along
+ * the main branch and all other branches forking off from them become
+ * unreachable and are freed together with the pieces only they used. */
+static void history_rebase(Text *txt, Revision *root, Revision *base) {
+	/* revisions are ordered chronologically i.e. parents before children */
+	for (Revision *rev = root; rev; rev = rev->later)
+		rev->discard = rev != base && (!rev->prev || rev->prev->discard);
+
+	/* pieces removed along the main branch are no longer part of any
+	 * reachable state. their changes are undone by nobody anymore */
+	for (Revision *rev = base; rev; rev = rev->prev) {
+		for (Change *next, *c = rev->change; c; c = next) {
+			next = c->next;
+			span_free(txt, &c->old);
+			free(c);
+		}
+		rev->change = NULL;
+	}
+
+	/* pieces introduced by abandoned branches were only used by them */
+	Revision *earlier = NULL;
+	for (Revision *later, *rev = root; rev; rev = later) {
+		later = rev->later;
+		if (!rev->discard) {
+			rev->earlier = earlier;
+			if (earlier)
+				earlier->later = rev;
+			earlier = rev;
+			continue;
+		}
+		for (Change *next, *c = rev->change; c; c = next) {
+			next = c->next;
+			span_free(txt, &c->new);
+			free(c);
+		}
+		if (rev->prev)
+			txt->revisions--;
+		txt->history_size -= rev->size;
+		if (txt->saved_revision == rev)
+			txt->saved_revision = NULL;
+		free(rev);
+	}
+	earlier->later = NULL;
+	txt->last_revision = earlier;
+	base->prev = NULL;
+	txt->revisions--;
+	txt->history_size -= base->size;
+	base->size = 0;
+	if (txt->history_garbage >= HISTORY_GARBAGE_SIZE)
+		blocks_collect(txt);
+}
+
+/* discard the oldest revisions along the main branch until the limits are met */
+static void history_compact(Text *txt) {
+	size_t max_revisions = txt->max_revisions, max_size = txt->max_history_size;
+	bool over_size = max_size && txt->history_size > max_size;
+	if (!over_size && !(max_revisions && txt->revisions > max_revisions))
+		return;
+	/* leave some headroom, such that not every snapshot triggers a compaction */
+	if (over_size)
+		max_size -= max_size / 4;
+	Revision *root = txt->history;
+	while (root->prev)
+		root = root->prev;
+	Revision *base = root;
+	size_t revisions = txt->revisions, size = txt->history_size;
+	while (base != txt->history && ((max_revisions && revisions > max_revisions) ||
+	       (max_size && size > max_size))) {
+		base = base->next;
+		revisions--;
+		size -= base->size;
+	}
+	if (base != root)
+		history_rebase(txt, root, base);
+}
+
+void text_history_limit(Text *txt, size_t revisions, size_t size) {
+	txt->max_revisions = revisions;
+	txt->max_history_size = size;
+	if (!txt->current_revision)
+		history_compact(txt);
+}
+
+/* create the file paged out history data is written to */
+static bool page_open(Text *txt) {
+	if (txt->page_fd != -1)
+		return true;
+	const char *dir = txt->page_dir ? txt->page_dir : getenv("TMPDIR");
+	if (!dir || !*dir)
+		dir = "/tmp";
+	size_t len = strlen(dir) + sizeof "/vis-XXXXXX";
+	char *name = malloc(len);
+	if (!name)
+		return false;
+	snprintf(name, len, "%s/vis-XXXXXX", dir);
+	int fd = mkstemp(name);
+	if (fd != -1 && unlink(name) == -1) {
+		close(fd);
+		fd = -1;
+	}
+	free(name);
+	txt->page_fd = fd;
+	txt->page_size = 0;
+	return fd != -1;
+}
+
+/* page out all whole pages of the block data between start and end */
+static bool page_range(Text *txt, Block *blk, size_t start, size_t end, size_t pagesize) {
+	start += (pagesize - start % pagesize) % pagesize;
+	end -= end % pagesize;
+	if (start >= end)
+		return true;
+	size_t base = (uintptr_t)blk->data;
+	if (!block_page(blk, start - base, end - base, txt->page_fd, txt->page_size))
+		return false;
+	txt->page_size += end - start;
+	Filerange r = { .start = start, .end = end };
+	return array_add(&txt->paged, &r);
+}
+
+/* Once the undo history grew by max_history_memory bytes, move the data of
+ * anonymous blocks which is no longer part of the current text content to
+ * the page file. Data still being appended to and partially used pages are
+ * kept in memory. */
+static void history_page(Text *txt) {
+	if (txt->history_paged > txt->history_size)
+		txt->history_paged = txt->history_size;
+	if (!txt->max_history_memory || txt->history_size - txt->history_paged < txt->max_history_memory)
+		return;
+	txt->history_paged = txt->history_size;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0 || !page_open(txt))
+		return;
+
+	/* data of the current text and data which was already paged out */
+	Array used;
+	array_init_sized(&used, sizeof(Filerange));
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		Filerange r = { .start = (uintptr_t)p->data, .end = (uintptr_t)(p->data + p->len) };
+		if (p->len && !array_add(&used, &r))
+			goto out;
+	}
+	for (size_t i = 0; i < array_length(&txt->paged); i++) {
+		if (!array_add(&used, array_get(&txt->paged, i)))
+			goto out;
+	}
+	ranges_merge(&used);
+
+	for (size_t i = 0; i < array_length(&txt->blocks); i++) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		if (blk->type != BLOCK_TYPE_ANON)
+			continue;
+		size_t start = (uintptr_t)blk->data, end = start + blk->len;
+		size_t idx = ranges_find(&used, start);
+		for (Filerange *r; start < end && (r = array_get(&used, idx)) && r->start < end; idx++) {
+			if (r->start > start && !page_range(txt, blk, start, r->start, pagesize))
+				goto out;
+			start = r->end;
+		}
+		if (start < end && !page_range(txt, blk, start, end, pagesize))
+			goto out;
+	}
+out:
+	array_release(&used);
+	ranges_merge(&txt->paged);
+}
+
+bool text_history_page(Text *txt, size_t size, const char *dir) {
+	char *copy = dir && *dir ? strdup(dir) : NULL;
+	if (dir && *dir && !copy)
+		return false;
+	if (txt->page_dir ? !copy || strcmp(txt->page_dir, copy) : !!copy) {
+		/* already paged out data remains accessible through its mapping */
+		if (txt->page_fd != -1)
+			close(txt->page_fd);
+		txt->page_fd = -1;
+	}
+	free(txt->page_dir);
+	txt->page_dir = copy;
+	txt->max_history_memory = size;
+	if (!txt->current_revision)
+		history_page(txt);
+	return true;
+}
+
+/* determine the run of adjacent small pieces starting at p, return its last piece */
+static Piece *defrag_run(Piece *p, size_t *len, size_t *count) {
+	Piece *end = NULL;
+	*len = *count = 0;
+	for (; p->next && p->len < DEFRAG_PIECE_SIZE && *len + p->len <= DEFRAG_MAX_SIZE; p = p->next) {
+		*len += p->len;
+		(*count)++;
+		end = p;
+	}
+	return end;
+}
+
+static int relocation_cmp(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t)((const Relocation*)a)->from;
+	uintptr_t y = (uintptr_t)((const Relocation*)b)->from;
+	return x < y ? -1 : x > y;
+}
+
+static int relocation_rev_cmp(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t)((const Relocation*)a)->to;
+	uintptr_t y = (uintptr_t)((const Relocation*)b)->to;
+	return x < y ? -1 : x > y;
+}
+
+/* record that len bytes at from were copied to. sorted is the number of
+ * relocations which were ordered by the previous text_defragment call */
+static bool relocation_add(Text *txt, const char *from, const char *to, size_t len, size_t sorted) {
+	Relocation r = { .from = from, .to = to, .len = len };
+	if (!array_add(&txt->relocations, &r) || !array_add(&txt->relocations_rev, &r))
+		return false;
+	/* if from is itself a copy, link its originals directly to the new one,
+	 * thereby any mark is resolved by at most two relocations */
+	size_t lo = 0, hi = sorted;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Relocation *o = array_get(&txt->relocations_rev, mid);
+		if (o->to < from + len)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	while (lo-- > 0) {
+		Relocation o = *(Relocation*)array_get(&txt->relocations_rev, lo);
+		if (o.to + DEFRAG_PIECE_SIZE <= from)
+			break;
+		const char *start = MAX(o.to, from), *end = MIN(o.to + o.len, from + len);
+		if (start >= end)
+			continue;
+		Relocation c = {
+			.from = o.from + (start - o.to),
+			.to = to + (start - from),
+			.len = end - start,
+		};
+		if (!array_add(&txt->relocations, &c) || !array_add(&txt->relocations_rev, &c))
+			return false;
+	}
+	return true;
+}
+
+/* replace the pieces start through end by a single one holding a copy of their
+ * len bytes. the change is recorded as part of rev, thus undone with it */
+static bool defrag_coalesce(Text *txt, Revision *rev, Piece *start, Piece *end, size_t len, size_t sorted) {
+	Block *blk = block_reserve(txt, len);
+	if (!blk)
+		return false;
+	/* unlike change_alloc, never start a new revision */
+	Change *c = calloc(1, sizeof *c);
+	Piece *new = piece_alloc(txt);
+	if (!c || !new)
+		goto err;
+
+	const char *data = blk->data + blk->len;
+	for (Piece *p = start; ; p = p->next) {
+		if (p->len > 0) {
+			const char *copy = block_append(blk, p->data, p->len);
+			if (!relocation_add(txt, p->data, copy, p->len, sorted))
+				goto err;
+		}
+		if (p == end)
+			break;
+	}
+
+	c->pos = EPOS;
+	c->next = rev->change;
+	if (rev->change)
+		rev->change->prev = c;
+	rev->change = c;
+	piece_init(new, start->prev, end->next, data, len);
+	span_init(&c->new, new, new);
+	span_init(&c->old, start, end);
+	span_swap(txt, &c->old, &c->new);
+	return true;
+err:
+	free(c);
+	piece_free(new);
+	return false;
+}
+
+bool text_defragment(Text *txt, bool force) {
+	/* the changes are recorded as part of the latest revision, no
+	 * later one may depend on the pieces being replaced */
+	Revision *rev = txt->current_revision ? txt->current_revision : txt->history;
+	if (!rev || rev->next)
+		return false;
+
+	size_t len, count;
+	if (!force) {
+		if (txt->pieces_allocated - txt->defrag_allocated < DEFRAG_MIN_PIECES)
+			return false;
+		txt->defrag_allocated = txt->pieces_allocated;
+		size_t candidates = 0;
+		for (Piece *p = txt->begin.next; p->next; p = p->next) {
+			Piece *end = defrag_run(p, &len, &count);
+			if (count > 1 && len > 0) {
+				candidates += count;
+				p = end;
+			}
+		}
+		if (candidates < DEFRAG_MIN_PIECES)
+			return false;
+	}
+
+	relocations_prune(txt);
+	bool success = true;
+	size_t sorted = array_length(&txt->relocations_rev);
+	for (Piece *next, *p = txt->begin.next; p->next; p = next) {
+		Piece *end = defrag_run(p, &len, &count);
+		next = end ? end->next : p->next;
+		if (count < 2 || len == 0)
+			continue;
+		if (!(success = defrag_coalesce(txt, rev, p, end, len, sorted)))
+			break;
+	}
+
+	txt->cache = NULL;
+	array_sort(&txt->relocations, relocation_cmp);
+	array_sort(&txt->relocations_rev, relocation_rev_cmp);
+	txt->defrag_allocated = txt->pieces_allocated;
+	return success;
+}
+
+
+/* copy the slice data stored in the given block to a new one */
+static bool slice_materialize(TextSlice *slice, Block *blk) {
+	size_t size = 0;
+	for (size_t i = 0, len = array_length(&slice->chunks); i < len; i++) {
+		SliceChunk *chunk = array_get(&slice->chunks, i);
+		if (chunk->block == blk)
+			size += chunk->len;
+	}
+	if (size == 0)
+		return true;
+	Block *copy = block_alloc(size);
+	if (!copy)
+		return false;
+	bool shared = false;
+	for (size_t i = 0, len = array_length(&slice->chunks); i < len; i++) {
+		SliceChunk *chunk = array_get(&slice->chunks, i);
+		if (chunk->block != blk)
+			continue;
+		chunk->data = block_append(copy, chunk->data, chunk->len);
+		chunk->block = shared ? block_ref(copy) : copy;
+		shared = true;
+		block_free(blk);
+	}
 	return true;
 }
 
+/* Slices outliving the text must not observe later changes to its file.
+ * Replace the pages of the mmap(2)-ed file content they refer to by a
+ * private copy, or failing that, copy their data to memory. */
+static void slices_detach(Text *txt, Block *blk) {
+	Array ranges;
+	array_init_sized(&ranges, sizeof(Filerange));
+	bool ret = true;
+	for (size_t i = 0, len = array_length(&txt->slices); ret && i < len; i++) {
+		TextSlice *slice = array_get_ptr(&txt->slices, i);
+		for (size_t j = 0, count = array_length(&slice->chunks); ret && j < count; j++) {
+			SliceChunk *chunk = array_get(&slice->chunks, j);
+			if (chunk->block != blk)
+				continue;
+			size_t start = chunk->data - blk->data;
+			Filerange r = text_range_new(start, start + chunk->len);
+			ret = array_add(&ranges, &r);
+		}
+	}
+	if (ret && array_length(&ranges) > 0) {
+		ranges_merge(&ranges);
+		ret = block_detach(blk, &ranges);
+	}
+	array_release(&ranges);
+	for (size_t i = 0, len = array_length(&txt->slices); !ret && i < len; i++)
+		slice_materialize(array_get_ptr(&txt->slices, i), blk);
+}
 
 void text_free(Text *txt) {
 	if (!txt)
@@ -776,9 +2423,33 @@ void text_free(Text *txt) {
 		piece_free(p);
 	}
 
-	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++)
-		block_free(array_get_ptr(&txt->blocks, i));
+	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		if (blk->refs > 0 && blk->type == BLOCK_TYPE_MMAP_ORIG)
+			slices_detach(txt, blk);
+		block_free(blk);
+	}
 	array_release(&txt->blocks);
+	for (size_t i = 0, len = array_length(&txt->slices); i < len; i++) {
+		TextSlice *slice = array_get_ptr(&txt->slices, i);
+		slice->txt = NULL;
+	}
+	array_release(&txt->slices);
+	for (size_t i = 0, len = array_length(&txt->retired); i < len; i++)
+		block_free(array_get_ptr(&txt->retired, i));
+	array_release(&txt->retired);
+	array_release(&txt->saved_content);
+	array_release(&txt->saved_index);
+	array_release(&txt->relocations);
+	array_release(&txt->relocations_rev);
+	array_release(&txt->paged);
+	if (txt->page_fd != -1)
+		close(txt->page_fd);
+	free(txt->page_dir);
+	journal_free(txt->journal, false);
+	brackets_free(txt->brackets);
+	columns_free(txt->columns);
+	words_free(txt->words);
 
 	free(txt);
 }
@@ -957,21 +2628,73 @@ Mark text_mark_set(Text *txt, size_t pos) {
 	return (Mark)(loc.piece->data + loc.off);
 }
 
-size_t text_mark_get(const Text *txt, Mark mark) {
-	size_t cur = 0;
-
-	if (mark == EMARK)
-		return EPOS;
-	if (mark == (Mark)&txt->end)
-		return txt->size;
-
-	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+/* position of the data referenced by mark within the current piece chain */
+static size_t mark_position(const Text *txt, Mark mark) {
+	/* marks near a recent modification are looked up first */
+	const Piece *hint = txt->lookup ? txt->lookup : &txt->begin;
+	size_t cur = txt->lookup ? txt->lookup_pos : 0;
+	for (const Piece *p = hint; p->next; p = p->next) {
+		Mark start = (Mark)(p->data);
+		Mark end = start + p->len;
+		if (start <= mark && mark < end)
+			return cur + (mark - start);
+		cur += p->len;
+	}
+	cur = 0;
+	for (const Piece *p = txt->begin.next; p != hint && p->next; p = p->next) {
 		Mark start = (Mark)(p->data);
 		Mark end = start + p->len;
 		if (start <= mark && mark < end)
 			return cur + (mark - start);
 		cur += p->len;
 	}
+	return EPOS;
+}
 
+/* position of data copied to or from the one referenced by mark. the same
+ * data might have been copied repeatedly, follow at most depth relocations */
+static size_t mark_relocate(const Text *txt, Mark mark, Mark prev, int depth) {
+	for (int forward = 1; forward >= 0; forward--) {
+		const Array *relocations = forward ? &txt->relocations : &txt->relocations_rev;
+		size_t lo = 0, hi = array_length(relocations);
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			Relocation *r = array_get(relocations, mid);
+			if ((Mark)(forward ? r->from : r->to) <= mark)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		/* relocated data is shorter than DEFRAG_PIECE_SIZE */
+		while (lo-- > 0) {
+			Relocation *r = array_get(relocations, lo);
+			Mark src = (Mark)(forward ? r->from : r->to);
+			Mark dst = (Mark)(forward ? r->to : r->from);
+			if (mark - src >= DEFRAG_PIECE_SIZE)
+				break;
+			if (mark - src >= r->len || dst + (mark - src) == prev)
+				continue;
+			size_t pos = mark_position(txt, dst + (mark - src));
+			if (pos == EPOS && depth > 1)
+				pos = mark_relocate(txt, dst + (mark - src), mark, depth - 1);
+			if (pos != EPOS)
+				return pos;
+		}
+	}
 	return EPOS;
 }
+
+size_t text_mark_get(const Text *txt, Mark mark) {
+	if (mark == EMARK)
+		return EPOS;
+	if (mark == (Mark)&txt->end)
+		return txt->size;
+
+	size_t pos = mark_position(txt, mark);
+	if (pos != EPOS)
+		return pos;
+
+	/* the referenced data might have been copied by text_defragment, or
+	 * the copy might have been replaced by its original through undo */
+	return mark_relocate(txt, mark, EMARK, MARK_RELOCATIONS_MAX);
+}
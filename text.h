@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 /** A mark. */
 typedef uintptr_t Mark;
@@ -29,6 +30,10 @@ typedef struct {
 typedef struct Text Text;
 typedef struct Piece Piece;
 typedef struct TextSave TextSave;
+/**
+ * Immutable copy of a text range, see ``text_slice_new``.
+ */
+typedef struct TextSlice TextSlice;
 
 /** A contiguous part of the text. */
 typedef struct {
@@ -111,6 +116,24 @@ Text *text_loadat(int dirfd, const char *filename);
  */
 Text *text_load_method(const char *filename, enum TextLoadMethod);
 Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod);
+/**
+ * Replace the text content with the one of the given file.
+ *
+ * Instead of loading the whole file, the common beginning and end
+ * of the current text and the file content are skipped and only the
+ * differing part in between is read. It replaces the corresponding
+ * text region as a single revision, hence the reload can be undone
+ * and marks outside of the region remain valid. If the file only grew
+ * since it was loaded or last saved, just the appended data is read.
+ *
+ * @rst
+ * .. note:: Fails with ``ENOTSUP`` if the file was truncated while
+ *           being memory mapped.
+ * @endrst
+ * @return Whether the file was reloaded, afterwards the text is no
+ *         longer considered modified.
+ */
+bool text_reload(Text*, const char *filename);
 /** Release all ressources associated with this text instance. */
 void text_free(Text*);
 /**
@@ -147,6 +170,16 @@ bool text_modified(const Text*);
  * @return Whether the insertion succeeded.
  */
 bool text_insert(Text*, size_t pos, const char *data, size_t len);
+/**
+ * Insert data repeatedly at the given byte position.
+ *
+ * The repetitions are recorded as a single change and the data is
+ * stored only once, unless it is short.
+ *
+ * @param count The number of times ``data`` is inserted.
+ * @return Whether the insertion succeeded.
+ */
+bool text_insert_repeat(Text*, size_t pos, const char *data, size_t len, size_t count);
 /**
  * Delete data at given byte position.
  *
@@ -156,8 +189,53 @@ bool text_insert(Text*, size_t pos, const char *data, size_t len);
  */
 bool text_delete(Text*, size_t pos, size_t len);
 bool text_delete_range(Text*, const Filerange*);
+/** A single modification, see ``text_edit``. */
+typedef struct {
+	size_t pos;       /**< Absolute byte position, prior to any of the modifications. */
+	size_t del;       /**< Number of bytes to delete, starting from ``pos``. */
+	const char *data; /**< Data to insert at ``pos``, after the deletion. */
+	size_t len;       /**< Length of the inserted data in bytes. */
+} TextEdit;
+/**
+ * Perform multiple modifications in a single pass through the text.
+ *
+ * They are recorded as one change, marks outside of deleted
+ * regions remain valid.
+ *
+ * @param edits The modifications ordered by position, they must not overlap.
+ *              Insertions at the same position are performed in order.
+ * @return Whether all modifications succeeded. Fails with ``EINVAL`` if
+ *         the edits are not ordered or out of range. The text is left
+ *         untouched upon failure.
+ */
+bool text_edit(Text*, const TextEdit *edits, size_t count);
 bool text_printf(Text*, size_t pos, const char *format, ...) __attribute__((format(printf, 3, 4)));
 bool text_appendf(Text*, const char *format, ...) __attribute__((format(printf, 2, 3)));
+/**
+ * @}
+ * @defgroup slice
+ * @{
+ */
+/**
+ * Capture the content of a range without copying it.
+ *
+ * The slice shares the storage of the underlying text and remains valid,
+ * with unchanged content, after the text is modified or freed.
+ * @return The slice, or ``NULL`` if the range is invalid or memory is exhausted.
+ */
+TextSlice *text_slice_new(Text*, const Filerange*);
+void text_slice_free(TextSlice*);
+/** Size of the slice content in bytes. */
+size_t text_slice_size(const TextSlice*);
+/** Copy ``len`` bytes starting from offset ``pos`` of the slice into ``buf``. */
+size_t text_slice_bytes_get(const TextSlice*, size_t pos, size_t len, char *buf);
+/**
+ * Insert the content of a slice, possibly taken from another text.
+ *
+ * Behaves like ``text_insert_repeat``, but shares the slice storage
+ * instead of copying it.
+ */
+bool text_insert_slice(Text*, size_t pos, const TextSlice*, size_t count);
 /**
  * @}
  * @defgroup history
@@ -198,6 +276,61 @@ size_t text_restore(Text*, time_t);
  * @endrst
  */
 time_t text_state(const Text*);
+/**
+ * Limit the memory used by the undo history.
+ *
+ * Once more than ``revisions`` revisions are kept, or their changes removed
+ * more than ``size`` bytes in total, the oldest ones are discarded together
+ * with all branches forking off from them. The data only they referenced
+ * is released. A limit of zero means unlimited.
+ * @rst
+ * .. note:: The current revision and those reachable by redo are always
+ *           kept. The size limit is undercut by a quarter upon compaction.
+ * @endrst
+ */
+void text_history_limit(Text*, size_t revisions, size_t size);
+/**
+ * Page out data only referenced by the undo history.
+ *
+ * Whenever the history grew by ``size`` bytes, data which is no longer
+ * part of the text content is written to an unlinked file in ``dir``,
+ * or ``$TMPDIR`` respectively ``/tmp`` if ``NULL``, and mapped from there.
+ * Its memory is thus released, while undo remains possible. A ``size`` of
+ * zero keeps all data in memory.
+ */
+bool text_history_page(Text*, size_t size, const char *dir);
+/**
+ * Store the revisions leading to the current state on disk.
+ *
+ * Only the main branch up to the current revision is preserved. The file
+ * is identified by the device, inode, size, modification time and a hash
+ * of content samples spread over the file, whose cost does not depend on
+ * the file size. Should be used after the whole text has been saved.
+ * An existing history file is atomically replaced.
+ */
+bool text_history_save(Text*, const char *filename);
+/**
+ * Restore revisions stored by ``text_history_save``.
+ *
+ * The removed data of the stored revisions is not copied into memory,
+ * instead it is referenced from a read only mapping of the history file.
+ * @return Whether the history could be restored, fails with ``EBUSY`` if
+ *         the text was already modified and with ``ESTALE`` if the file
+ *         content changed after the history was saved.
+ */
+bool text_history_load(Text*, const char *filename);
+/**
+ * Coalesce runs of adjacent small pieces into contiguous copies.
+ *
+ * Heavy editing splits the text into many short pieces, slowing down
+ * lookups and iteration. The replacement is recorded as part of the most
+ * recent revision, hence undone together with it. Existing marks remain
+ * valid. Unless ``force`` is given, nothing is done if the text is not
+ * considered fragmented.
+ * @return Whether the text was defragmented, fails if the current revision
+ *         is not the latest one i.e. a redo operation is possible.
+ */
+bool text_defragment(Text*, bool force);
 /**
  * @}
  * @defgroup lines
@@ -341,6 +474,24 @@ enum TextSaveMethod {
 	 * @endrst
 	 */
 	TEXT_SAVE_INPLACE,
+	/**
+	 * Only write modified regions of the file in place.
+	 *
+	 * Compares the current content with the one at load or last save time
+	 * and uses ``pwrite(2)`` to update the changed regions. The previous
+	 * content of these regions is first stored in a journal named
+	 * ``.filename.vis.save`` which is used to restore the file if a write
+	 * fails and which is only removed once the new content has been synced
+	 * to disk. If the process crashes in between, the previous content can
+	 * be restored by means of ``text_save_rollback``.
+	 *
+	 * @rst
+	 * .. note:: Falls back to ``TEXT_SAVE_ATOMIC`` if the file was modified
+	 *           externally, if the whole text is not written in one go or
+	 *           if more than half of the file content changed.
+	 * @endrst
+	 */
+	TEXT_SAVE_INCREMENTAL,
 };
 
 /**
@@ -384,6 +535,24 @@ ssize_t text_save_write_range(TextSave*, const Filerange*);
  * @endrst
  */
 bool text_save_commit(TextSave*);
+/**
+ * Commit multiple save operations at once.
+ *
+ * Has the same effect as calling ``text_save_commit`` for each of them,
+ * but initiates the write back of all files before waiting for any of
+ * them and syncs every involved directory only once.
+ *
+ * @param ctx The save operations to commit, ``NULL`` entries are ignored.
+ * @param count The number of save operations.
+ * @param errors Stores for every operation ``0`` if it succeeded or the
+ *               ``errno`` value describing its failure.
+ * @return Whether all changes have been saved.
+ * @rst
+ * .. note:: Releases the underlying resources of all given ``TextSave``
+ *           pointers which must no longer be used.
+ * @endrst
+ */
+bool text_save_commit_all(TextSave *ctx[], size_t count, int errors[]);
 /**
  * Abort a save operation.
  * @rst
@@ -393,6 +562,17 @@ bool text_save_commit(TextSave*);
  * @endrst
  */
 void text_save_cancel(TextSave*);
+/**
+ * Roll back an interrupted incremental save.
+ *
+ * Restores the previous content of the file from the journal left behind
+ * by a ``TEXT_SAVE_INCREMENTAL`` save which did not complete, and removes
+ * the journal afterwards.
+ * @return Whether the file was restored, fails with ``ENOENT`` if there is
+ *         no such journal and with ``ESTALE`` if the file was modified after
+ *         the save was interrupted.
+ */
+bool text_save_rollback(const char *filename);
 /**
  * Write whole text content to file descriptor.
  * @return The number of bytes written or ``-1`` in case of an error.
@@ -403,6 +583,54 @@ ssize_t text_write(const Text*, int fd);
  * @return The number of bytes written or ``-1`` in case of an error.
  */
 ssize_t text_write_range(const Text*, const Filerange*, int fd);
+/**
+ * Describe file range by the memory regions holding its content.
+ *
+ * No data is copied, the entries point into internal storage and remain
+ * valid until the text is next modified. Suitable for ``writev(2)``.
+ * @return The number of entries used, at most ``count``. If all of them
+ *         were used the range might not be covered completely, the rest
+ *         starts after the sum of their lengths.
+ */
+size_t text_iovec(const Text*, const Filerange*, struct iovec *iov, size_t count);
+/**
+ * @}
+ * @defgroup journal
+ * @{
+ */
+/**
+ * Record all subsequent modifications in an append only journal.
+ *
+ * The journal describes the changes relative to the file content at load
+ * or last save time and can be used to recover them after a crash. Changes
+ * are buffered in memory until ``text_journal_sync`` writes them to disk.
+ *
+ * If a journal is already open, it is truncated such that it describes
+ * the changes relative to the current file content instead. Should be
+ * used after the whole text has been saved.
+ * @return Whether the journal could be created, fails with ``EEXIST`` if
+ *         it already exists, for example because of a previous crash.
+ */
+bool text_journal_open(Text*, const char *filename);
+/**
+ * Apply the changes recorded in an existing journal.
+ *
+ * Only changes up to the last successful ``text_journal_sync`` are applied.
+ * Afterwards the journal is used to record subsequent modifications.
+ * @return Whether the journal could be replayed, fails with ``ESTALE`` if
+ *         the file was modified after the journal was created.
+ */
+bool text_journal_recover(Text*, const char *filename);
+/** Check whether there are recorded changes which are not yet synced. */
+bool text_journal_pending(const Text*);
+/**
+ * Write all recorded changes to the journal and flush them to disk.
+ * @return Whether the journal is intact, once a change could not be
+ *         recorded all further ones are ignored.
+ */
+bool text_journal_sync(Text*);
+/** Stop recording changes and remove the journal. */
+void text_journal_close(Text*);
 /**
  * @}
  * @defgroup misc
@@ -413,6 +641,18 @@ ssize_t text_write_range(const Text*, const Filerange*, int fd);
  * this text instance.
  */
 bool text_mmaped(const Text*, const char *ptr);
+/**
+ * Iterate over all distinct words starting with ``prefix``, in lexicographic order.
+ *
+ * Words are maximal sequences of bytes which are not a word boundary as
+ * defined by ``is_word_boundary``. They are indexed upon the first call,
+ * afterwards only the regions affected by modifications are rescanned.
+ * @param prefix The prefix words need to start with, ``NULL`` matches all.
+ * @param handle Invoked with every word and its number of occurrences,
+ *               the iteration stops if it returns false.
+ * @return Whether the index is up to date, fails if we run out of memory.
+ */
+bool text_words(Text*, const char *prefix, bool (*handle)(const char *word, size_t count, void *data), void *data);
 /** @} */
 
 #endif
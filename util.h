@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
 #define MIN(a, b)  ((a) > (b) ? (b) : (a))
@@ -34,6 +35,22 @@ static void *memrchr(const void *m, int c, size_t n)
 }
 #endif
 
+/* nanosecond part of the modification time, zero where it is not available */
+static inline long stat_mtime_nsec(const struct stat *meta) {
+#if HAVE_ST_MTIM
+	return meta->st_mtim.tv_nsec;
+#elif HAVE_ST_MTIMESPEC
+	return meta->st_mtimespec.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+/* whether both files were last modified at the same time */
+static inline bool stat_mtime_equal(const struct stat *a, const struct stat *b) {
+	return a->st_mtime == b->st_mtime && stat_mtime_nsec(a) == stat_mtime_nsec(b);
+}
+
 /* Needed for building on GNU Hurd */
 
 #ifndef PIPE_BUF
@@ -47,10 +47,13 @@ struct Selection {
 	int row, col;           /* in terms of zero based screen coordinates */
 	int lastcol;            /* remembered column used when moving across lines */
 	Line *line;             /* screen line on which cursor currently resides */
+	unsigned int drawn;     /* value of view->draws when row, col and line were updated */
 	int generation;         /* used to filter out newly created cursors during iteration */
-	int number;             /* how many cursors are located before this one */
 	View *view;             /* associated view to which this cursor belongs */
 	Selection *prev, *next; /* previous/next cursors ordered by location at creation time */
+	Selection *parent, *left, *right; /* same order as a treap, see selection_link */
+	unsigned int priority;  /* random heap priority within the treap */
+	int size;               /* number of cursors in the subtree rooted here */
 };
 
 struct View {
@@ -76,7 +79,10 @@ struct View {
 	const SyntaxSymbol *symbols[SYNTAX_SYMBOL_LAST]; /* symbols to use for white spaces etc */
 	int tabwidth;       /* how many spaces should be used to display a tab character */
 	Selection *selections;    /* all cursors currently active */
+	Selection *selection_root; /* root of the treap indexing them */
+	unsigned int selection_seed; /* state of the treap priority generator */
 	int selection_generation; /* used to filter out newly created cursors during iteration */
+	unsigned int draws; /* number of redraws, screen coordinates of cursors from earlier ones are stale */
 	bool need_update;   /* whether view has been redrawn */
 	bool large_file;    /* optimize for displaying large files */
 	int colorcolumn;
@@ -111,6 +117,7 @@ static bool view_viewport_down(View *view, int n);
 static void view_clear(View *view);
 static bool view_addch(View *view, Cell *cell);
 static void selection_free(Selection*);
+static Selection *selections_find(View*, size_t pos);
 /* set/move current cursor position to a given (line, column) pair */
 static size_t cursor_set(Selection*, Line *line, int col);
 
@@ -266,6 +273,7 @@ static void cursor_to(Selection *s, size_t pos) {
 	if (pos != s->pos)
 		s->lastcol = 0;
 	s->pos = pos;
+	s->drawn = s->view->draws;
 	if (!view_coord_get(s->view, pos, &s->line, &s->row, &s->col)) {
 		if (s->view->selection == s) {
 			s->line = s->view->topline;
@@ -278,6 +286,19 @@ static void cursor_to(Selection *s, size_t pos) {
 	view_draw(s->view);
 }
 
+static void cursor_sync(Selection *s) {
+	View *view = s->view;
+	if (s->drawn == view->draws)
+		return;
+	s->drawn = view->draws;
+	size_t pos = view_cursors_pos(s);
+	if (!view_coord_get(view, pos, &s->line, &s->row, &s->col) && s == view->selection) {
+		s->line = view->topline;
+		s->row = 0;
+		s->col = 0;
+	}
+}
+
 bool view_coord_get(View *view, size_t pos, Line **retline, int *retrow, int *retcol) {
 	int row = 0, col = 0;
 	size_t cur = view->start;
@@ -417,16 +438,16 @@ void view_draw(View *view) {
 			view->line->cells[x] = view->cell_blank;
 	}
 
-	/* resync position of cursors within visible area */
-	for (Selection *s = view->selections; s; s = s->next) {
-		size_t pos = view_cursors_pos(s);
-		if (!view_coord_get(view, pos, &s->line, &s->row, &s->col) &&
-		    s == view->selection) {
-			s->line = view->topline;
-			s->row = 0;
-			s->col = 0;
-		}
+	/* resync position of cursors within visible area, those outside of it are
+	 * invalidated and updated on demand by cursor_sync */
+	view->draws++;
+	for (Selection *s = selections_find(view, view->start); s; s = s->next) {
+		if (view_cursors_pos(s) > view->end)
+			break;
+		cursor_sync(s);
 	}
+	if (view->selection)
+		cursor_sync(view->selection);
 
 	view->need_update = true;
 }
@@ -728,6 +749,7 @@ size_t view_scroll_down(View *view, int lines) {
 }
 
 size_t view_line_up(Selection *sel) {
+	cursor_sync(sel);
 	View *view = sel->view;
 	int lastcol = sel->lastcol;
 	if (!lastcol)
@@ -744,6 +766,7 @@ size_t view_line_up(Selection *sel) {
 }
 
 size_t view_line_down(Selection *sel) {
+	cursor_sync(sel);
 	View *view = sel->view;
 	int lastcol = sel->lastcol;
 	if (!lastcol)
@@ -760,6 +783,7 @@ size_t view_line_down(Selection *sel) {
 }
 
 size_t view_screenline_up(Selection *sel) {
+	cursor_sync(sel);
 	if (!sel->line)
 		return view_line_up(sel);
 	int lastcol = sel->lastcol;
@@ -774,6 +798,7 @@ size_t view_screenline_up(Selection *sel) {
 }
 
 size_t view_screenline_down(Selection *sel) {
+	cursor_sync(sel);
 	if (!sel->line)
 		return view_line_down(sel);
 	int lastcol = sel->lastcol;
@@ -788,18 +813,21 @@ size_t view_screenline_down(Selection *sel) {
 }
 
 size_t view_screenline_begin(Selection *sel) {
+	cursor_sync(sel);
 	if (!sel->line)
 		return sel->pos;
 	return cursor_set(sel, sel->line, 0);
 }
 
 size_t view_screenline_middle(Selection *sel) {
+	cursor_sync(sel);
 	if (!sel->line)
 		return sel->pos;
 	return cursor_set(sel, sel->line, sel->line->width / 2);
 }
 
 size_t view_screenline_end(Selection *sel) {
+	cursor_sync(sel);
 	if (!sel->line)
 		return sel->pos;
 	int col = sel->line->width - 1;
@@ -819,6 +847,7 @@ Line *view_lines_last(View *view) {
 }
 
 Line *view_cursors_line_get(Selection *sel) {
+	cursor_sync(sel);
 	return sel->line;
 }
 
@@ -869,6 +898,106 @@ size_t view_screenline_goto(View *view, int n) {
 	return pos;
 }
 
+/* Besides the doubly linked list used for iteration, cursors are organized as
+ * a treap: a binary tree ordered like the list which is kept balanced by
+ * maintaining the heap property of random node priorities. Storing subtree
+ * sizes allows to determine the number of a cursor and to locate the insertion
+ * point of a new one in logarithmic time. */
+
+static int selection_size(Selection *s) {
+	return s ? s->size : 0;
+}
+
+static void selection_resize(Selection *s) {
+	s->size = 1 + selection_size(s->left) + selection_size(s->right);
+}
+
+/* replace the edge from parent to s by one to child */
+static void selection_replace(View *view, Selection *s, Selection *child) {
+	Selection *parent = s->parent;
+	if (child)
+		child->parent = parent;
+	if (!parent)
+		view->selection_root = child;
+	else if (parent->left == s)
+		parent->left = child;
+	else
+		parent->right = child;
+}
+
+/* rotate s above its parent */
+static void selection_rotate(View *view, Selection *s) {
+	Selection *parent = s->parent;
+	selection_replace(view, parent, s);
+	if (parent->left == s) {
+		parent->left = s->right;
+		if (s->right)
+			s->right->parent = parent;
+		s->right = parent;
+	} else {
+		parent->right = s->left;
+		if (s->left)
+			s->left->parent = parent;
+		s->left = parent;
+	}
+	parent->parent = s;
+	selection_resize(parent);
+	selection_resize(s);
+}
+
+/* insert s into the treap, it must already be linked into the list */
+static void selection_link(View *view, Selection *s) {
+	/* xorshift, the priorities merely need to be uncorrelated to the order */
+	unsigned int x = view->selection_seed ? view->selection_seed : 2463534242u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	view->selection_seed = x;
+	s->priority = x;
+	s->left = s->right = NULL;
+	s->size = 1;
+	/* s becomes the right child of its predecessor, or the left one of
+	 * its successor, whichever is free */
+	if (s->prev && !s->prev->right) {
+		s->parent = s->prev;
+		s->prev->right = s;
+	} else if (s->next) {
+		s->parent = s->next;
+		s->next->left = s;
+	} else {
+		s->parent = NULL;
+		view->selection_root = s;
+	}
+	for (Selection *p = s->parent; p; p = p->parent)
+		p->size++;
+	while (s->parent && s->parent->priority < s->priority)
+		selection_rotate(view, s);
+}
+
+/* remove s from the treap, it is still linked into the list */
+static void selection_unlink(View *view, Selection *s) {
+	while (s->left && s->right)
+		selection_rotate(view, s->left->priority > s->right->priority ? s->left : s->right);
+	for (Selection *p = s->parent; p; p = p->parent)
+		p->size--;
+	selection_replace(view, s, s->left ? s->left : s->right);
+	s->parent = s->left = s->right = NULL;
+}
+
+/* first cursor located at or after pos, NULL if there is none */
+static Selection *selections_find(View *view, size_t pos) {
+	Selection *next = NULL;
+	for (Selection *s = view->selection_root; s; ) {
+		if (pos <= view_cursors_pos(s)) {
+			next = s;
+			s = s->left;
+		} else {
+			s = s->right;
+		}
+	}
+	return next;
+}
+
 static Selection *selections_new(View *view, size_t pos, bool force) {
 	if (pos > text_size(view->text))
 		return NULL;
@@ -882,47 +1011,41 @@ static Selection *selections_new(View *view, size_t pos, bool force) {
 		view->selection_latest = s;
 		view->selections = s;
 		view->selection_count = 1;
+		selection_link(view, s);
 		return s;
 	}
 
+	/* cursors are commonly created in ascending order, check whether the new
+	 * one directly follows the latest before looking it up */
 	Selection *prev = NULL, *next = NULL;
 	Selection *latest = view->selection_latest ? view->selection_latest : view->selection;
 	size_t cur = view_cursors_pos(latest);
 	if (pos == cur) {
 		prev = latest;
 		next = prev->next;
-	} else if (pos > cur) {
+	} else if (pos > cur && (!latest->next || pos <= (cur = view_cursors_pos(latest->next)))) {
 		prev = latest;
-		for (next = prev->next; next; prev = next, next = next->next) {
-			cur = view_cursors_pos(next);
-			if (pos <= cur)
-				break;
-		}
-	} else if (pos < cur) {
-		next = latest;
-		for (prev = next->prev; prev; next = prev, prev = prev->prev) {
-			cur = view_cursors_pos(prev);
-			if (pos >= cur)
-				break;
-		}
+		next = prev->next;
+	} else {
+		next = selections_find(view, pos);
+		prev = next ? next->prev : NULL;
+		if (!next)
+			for (prev = view->selection_root; prev->right; prev = prev->right);
+		cur = next ? view_cursors_pos(next) : EPOS;
 	}
 
 	if (pos == cur && !force)
 		goto err;
 
-	for (Selection *after = next; after; after = after->next)
-		after->number++;
-
 	s->prev = prev;
 	s->next = next;
 	if (next)
 		next->prev = s;
-	if (prev) {
+	if (prev)
 		prev->next = s;
-		s->number = prev->number + 1;
-	} else {
+	else
 		view->selections = s;
-	}
+	selection_link(view, s);
 	view->selection_latest = s;
 	view->selection_count++;
 	view_selections_dispose(view->selection_dead);
@@ -946,7 +1069,12 @@ int view_selections_count(View *view) {
 }
 
 int view_selections_number(Selection *sel) {
-	return sel->number;
+	int number = selection_size(sel->left);
+	for (Selection *s = sel; s->parent; s = s->parent) {
+		if (s->parent->right == s)
+			number += selection_size(s->parent->left) + 1;
+	}
+	return number;
 }
 
 int view_selections_column_count(View *view) {
@@ -1005,8 +1133,7 @@ Selection *view_selections_column_next(Selection *sel, int column) {
 static void selection_free(Selection *s) {
 	if (!s)
 		return;
-	for (Selection *after = s->next; after; after = after->next)
-		after->number--;
+	selection_unlink(s->view, s);
 	if (s->prev)
 		s->prev->next = s->next;
 	if (s->next)
@@ -1023,6 +1150,15 @@ static void selection_free(Selection *s) {
 	free(s);
 }
 
+/* dispose a selection without updating the primary one, which is left to
+ * callers disposing of many selections at once */
+static bool selection_discard(Selection *s) {
+	if (s->view->selection_count < 2)
+		return false;
+	selection_free(s);
+	return true;
+}
+
 bool view_selections_dispose(Selection *sel) {
 	if (!sel)
 		return true;
@@ -1056,6 +1192,23 @@ Selection *view_selections(View *view) {
 	return view->selections;
 }
 
+Selection *view_selections_intersect(View *view, const Filerange *r) {
+	view->selection_generation++;
+	Selection *s = selections_find(view, r->start), *prev;
+	if (s)
+		prev = s->prev;
+	else
+		for (prev = view->selection_root; prev && prev->right; prev = prev->right);
+	/* selections are ordered by cursor, an earlier one might still extend into the range */
+	for (; prev; prev = prev->prev) {
+		Filerange sel = view_selections_get(prev);
+		if (!text_range_valid(&sel) || sel.end <= r->start)
+			break;
+		s = prev;
+	}
+	return s;
+}
+
 Selection *view_selections_primary_get(View *view) {
 	view->selection_generation++;
 	return view->selection;
@@ -1105,10 +1258,12 @@ size_t view_cursors_col(Selection *s) {
 }
 
 int view_cursors_cell_get(Selection *s) {
+	cursor_sync(s);
 	return s->line ? s->col : -1;
 }
 
 int view_cursors_cell_set(Selection *s, int cell) {
+	cursor_sync(s);
 	if (!s->line || cell < 0)
 		return -1;
 	cursor_set(s, s->line, cell);
@@ -1273,7 +1428,7 @@ void view_selections_set_all(View *view, Array *arr, bool anchored) {
 				if (i == 1 && s == view->selection)
 					view_selection_clear(s);
 				else
-					view_selections_dispose(s);
+					selection_discard(s);
 			}
 			break;
 		}
@@ -1304,14 +1459,15 @@ Array view_selections_get_all(View *view) {
 void view_selections_normalize(View *view) {
 	Selection *prev = NULL;
 	Filerange range_prev = text_range_empty();
+	bool disposed = false;
 	for (Selection *s = view->selections, *next; s; s = next) {
 		next = s->next;
 		Filerange range = view_selections_get(s);
 		if (!text_range_valid(&range)) {
-			view_selections_dispose(s);
+			disposed |= selection_discard(s);
 		} else if (prev && text_range_overlap(&range_prev, &range)) {
 			range_prev = text_range_union(&range_prev, &range);
-			view_selections_dispose(s);
+			disposed |= selection_discard(s);
 		} else {
 			if (prev)
 				view_selections_set(prev, &range_prev);
@@ -1321,6 +1477,8 @@ void view_selections_normalize(View *view) {
 	}
 	if (prev)
 		view_selections_set(prev, &range_prev);
+	if (disposed)
+		view_selections_primary_set(view->selection);
 }
 
 Text *view_text(View *view) {
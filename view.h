@@ -147,7 +147,8 @@ void view_selections_dispose_all(View*);
 void view_selections_normalize(View*);
 /**
  * Replace currently active selections.
- * @param array The array of ``Filerange`` objects.
+ * @param array The array of ``Filerange`` objects, preferably ordered by
+ *              position, which avoids a lookup per newly created selection.
  * @param anchored Whether *all* selection should be anchored.
  */
 void view_selections_set_all(View*, Array*, bool anchored);
@@ -162,6 +163,14 @@ Selection *view_selections_primary_get(View*);
 void view_selections_primary_set(Selection*);
 /** Get first selection. */
 Selection *view_selections(View*);
+/**
+ * Get first selection intersecting the given range.
+ * @rst
+ * .. note:: Successors are obtained by `view_selections_next` and
+ *           iteration can stop once they start after the range.
+ * @endrst
+ */
+Selection *view_selections_intersect(View*, const Filerange*);
 /** Get immediate predecessor of selection. */
 Selection *view_selections_prev(Selection*);
 /** Get immediate successor of selection. */
@@ -326,9 +326,11 @@ static bool cmd_set(Vis *vis, Win *win, Command *cmd, const char *argv[], Select
 			win->file->save_method = TEXT_SAVE_ATOMIC;
 		} else if (strcmp("inplace", arg.s) == 0) {
 			win->file->save_method = TEXT_SAVE_INPLACE;
+		} else if (strcmp("incremental", arg.s) == 0) {
+			win->file->save_method = TEXT_SAVE_INCREMENTAL;
 		} else {
 			vis_info_show(vis, "Invalid save method `%s', expected "
-			              "'auto', 'atomic' or 'inplace'", arg.s);
+			              "'auto', 'atomic', 'inplace' or 'incremental'", arg.s);
 			return false;
 		}
 		break;
@@ -364,6 +366,50 @@ static bool cmd_set(Vis *vis, Win *win, Command *cmd, const char *argv[], Select
 	case OPTION_IGNORECASE:
 		vis->ignorecase = toggle ? !vis->ignorecase : arg.b;
 		break;
+	case OPTION_JOURNAL:
+		vis->journal = toggle ? !vis->journal : arg.b;
+		for (File *file = vis->files; file; file = file->next) {
+			if (vis->journal)
+				file_journal_open(vis, file);
+			else
+				file_journal_close(file);
+		}
+		break;
+	case OPTION_AUTORELOAD:
+		vis->autoreload = toggle ? !vis->autoreload : arg.b;
+		break;
+	case OPTION_UNDOFILE:
+		vis->undofile = toggle ? !vis->undofile : arg.b;
+		break;
+	case OPTION_UNDOLEVELS:
+	case OPTION_UNDOSIZE:
+		if (arg.i < 0) {
+			vis_info_show(vis, "Expecting positive number");
+			return false;
+		}
+		if (opt_index == OPTION_UNDOLEVELS)
+			vis->undolevels = arg.i;
+		else
+			vis->undosize = (size_t)arg.i << 20;
+		for (File *file = vis->files; file; file = file->next)
+			text_history_limit(file->text, vis->undolevels, vis->undosize);
+		break;
+	case OPTION_UNDOMEMORY:
+	case OPTION_UNDODIR:
+		if (opt_index == OPTION_UNDOMEMORY) {
+			vis->undomemory = (size_t)arg.i << 20;
+		} else {
+			char *dir = *arg.s ? strdup(arg.s) : NULL;
+			if (*arg.s && !dir) {
+				vis_info_show(vis, "Failed to change undo directory");
+				return false;
+			}
+			free(vis->undodir);
+			vis->undodir = dir;
+		}
+		for (File *file = vis->files; file; file = file->next)
+			text_history_page(file->text, vis->undomemory, vis->undodir);
+		break;
 	default:
 		if (!opt->func)
 			return false;
@@ -628,6 +674,241 @@ static bool cmd_earlier_later(Vis *vis, Win *win, Command *cmd, const char *argv
 	return pos != EPOS;
 }
 
+/* a line of a range being reordered, refers to a copy of the range content */
+typedef struct {
+	const char *data; /* start of the line, excluding its newline */
+	size_t len;       /* length in bytes */
+	const char *key;  /* start of the sort key, within the line */
+	uint64_t prefix;  /* leading key bytes, compared before the key itself */
+	double num;       /* numeric value of the key, for numeric sorting */
+} LineRef;
+
+/* split a copy of the range content into lines. returns the copy, to be
+ * freed once the lines are no longer needed, or NULL on failure */
+static char *lines_get(Text *txt, Filerange *range, Array *lines, bool *newline) {
+	size_t size = text_range_size(range);
+	array_init_sized(lines, sizeof(LineRef));
+	char *data = malloc(size + 1);
+	if (!data)
+		return NULL;
+	size = text_bytes_get(txt, range->start, size, data);
+	data[size] = '\0';
+	*newline = size > 0 && data[size-1] == '\n';
+	const char *end = data + size - *newline;
+	for (const char *cur = data; cur; ) {
+		const char *nl = memchr(cur, '\n', end - cur);
+		LineRef line = { .data = cur, .len = (nl ? nl : end) - cur, .key = cur };
+		if (!array_add(lines, &line)) {
+			array_release(lines);
+			free(data);
+			return NULL;
+		}
+		cur = nl ? nl + 1 : NULL;
+	}
+	return data;
+}
+
+/* replace the range by the lines, in their current order */
+static bool lines_put(Win *win, Selection *sel, Filerange *range, Array *lines, bool newline) {
+	Buffer buf;
+	buffer_init(&buf);
+	if (!buffer_reserve(&buf, text_range_size(range) + 1))
+		return false;
+	for (size_t i = 0, count = array_length(lines); i < count; i++) {
+		LineRef *line = array_get(lines, i);
+		buffer_append(&buf, line->data, line->len);
+		if (i + 1 < count || newline)
+			buffer_append(&buf, "\n", 1);
+	}
+	size_t len = buffer_length(&buf);
+	char *data = buffer_move(&buf);
+	bool ret = sam_change(win, sel, range, data, len, 1);
+	if (!ret)
+		free(data);
+	return ret;
+}
+
+static void lines_reverse(Array *lines) {
+	for (size_t i = 0, count = array_length(lines); i < count / 2; i++) {
+		LineRef *a = array_get(lines, i), *b = array_get(lines, count - i - 1);
+		LineRef tmp = *a;
+		*a = *b;
+		*b = tmp;
+	}
+}
+
+/* remove lines considered equal to their predecessor */
+static void lines_unique(Array *lines, int (*cmp)(const void*, const void*)) {
+	size_t count = array_length(lines), len = count > 0;
+	for (size_t i = 1; i < count; i++) {
+		LineRef *line = array_get(lines, i);
+		if (cmp(array_get(lines, len - 1), line) != 0)
+			array_set(lines, len++, line);
+	}
+	array_truncate(lines, len);
+}
+
+static int memcmp_len(const char *a, size_t alen, const char *b, size_t blen) {
+	int r = memcmp(a, b, MIN(alen, blen));
+	if (r)
+		return r;
+	return (alen > blen) - (alen < blen);
+}
+
+static int line_cmp(const void *a, const void *b) {
+	const LineRef *l1 = a, *l2 = b;
+	return memcmp_len(l1->data, l1->len, l2->data, l2->len);
+}
+
+static int key_cmp(const void *a, const void *b) {
+	const LineRef *l1 = a, *l2 = b;
+	if (l1->prefix != l2->prefix)
+		return l1->prefix < l2->prefix ? -1 : 1;
+	return memcmp_len(l1->key, l1->len - (l1->key - l1->data),
+	                  l2->key, l2->len - (l2->key - l2->data));
+}
+
+static int key_cmp_numeric(const void *a, const void *b) {
+	const LineRef *l1 = a, *l2 = b;
+	return (l1->num > l2->num) - (l1->num < l2->num);
+}
+
+static int sort_cmp(const void *a, const void *b) {
+	int r = key_cmp(a, b);
+	return r ? r : line_cmp(a, b);
+}
+
+static int sort_cmp_numeric(const void *a, const void *b) {
+	int r = key_cmp_numeric(a, b);
+	return r ? r : sort_cmp(a, b);
+}
+
+/* start of the n-th blank separated field, including its leading blanks */
+static const char *line_field(const char *s, const char *end, size_t n) {
+	while (--n > 0) {
+		while (s < end && (*s == ' ' || *s == '\t'))
+			s++;
+		while (s < end && *s != ' ' && *s != '\t')
+			s++;
+	}
+	return s;
+}
+
+/* value of the leading decimal number, zero if there is none */
+static double line_number(const char *s, const char *end) {
+	double num = 0, scale = 1;
+	while (s < end && (*s == ' ' || *s == '\t'))
+		s++;
+	bool negative = s < end && *s == '-';
+	if (negative)
+		s++;
+	for (; s < end && '0' <= *s && *s <= '9'; s++)
+		num = 10 * num + (*s - '0');
+	if (s < end && *s == '.') {
+		for (s++; s < end && '0' <= *s && *s <= '9'; s++)
+			num += (*s - '0') * (scale /= 10);
+	}
+	return negative ? -num : num;
+}
+
+static bool cmd_sort(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
+	if (!win)
+		return false;
+	bool numeric = false, reverse = false, unique = false;
+	long field = 1;
+	for (const char **arg = &argv[1]; *arg; arg++) {
+		const char *s = *arg;
+		if (*s++ != '-' || !*s)
+			goto usage;
+		for (; *s; s++) {
+			switch (*s) {
+			case 'n': numeric = true; break;
+			case 'r': reverse = true; break;
+			case 'u': unique = true; break;
+			case 'k':
+			{
+				char *end;
+				if (!*++s && !(s = *++arg))
+					goto usage;
+				errno = 0;
+				field = strtol(s, &end, 10);
+				if (errno || end == s || *end || field < 1)
+					goto usage;
+				s = end - 1;
+				break;
+			}
+			default:
+				goto usage;
+			}
+		}
+	}
+
+	Array lines;
+	bool newline;
+	char *data = lines_get(win->file->text, range, &lines, &newline);
+	if (!data)
+		return false;
+	for (size_t i = 0, count = array_length(&lines); i < count; i++) {
+		LineRef *line = array_get(&lines, i);
+		const char *end = line->data + line->len;
+		line->key = line_field(line->data, end, field);
+		for (const char *k = line->key; k < line->key + sizeof(line->prefix); k++)
+			line->prefix = line->prefix << 8 | (k < end ? (unsigned char)*k : 0);
+		if (numeric)
+			line->num = line_number(line->key, end);
+	}
+	array_sort(&lines, numeric ? sort_cmp_numeric : sort_cmp);
+	if (unique)
+		lines_unique(&lines, numeric ? key_cmp_numeric : key_cmp);
+	if (reverse)
+		lines_reverse(&lines);
+	bool ret = lines_put(win, sel, range, &lines, newline);
+	array_release(&lines);
+	free(data);
+	return ret;
+usage:
+	vis_info_show(vis, "Expecting: sort [-n] [-r] [-u] [-k field]");
+	return false;
+}
+
+/* implements uniq, reverse and shuffle */
+static bool cmd_lines(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
+	static uint64_t state;
+	if (!win)
+		return false;
+	Array lines;
+	bool newline;
+	char *data = lines_get(win->file->text, range, &lines, &newline);
+	if (!data)
+		return false;
+	switch (argv[0][0]) {
+	case 'u':
+		lines_unique(&lines, line_cmp);
+		break;
+	case 'r':
+		lines_reverse(&lines);
+		break;
+	case 's':
+		if (!state)
+			state = ((uint64_t)time(NULL) << 20 ^ (uint64_t)getpid()) | 1;
+		for (size_t i = array_length(&lines); i > 1; i--) {
+			/* xorshift64 */
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			LineRef *a = array_get(&lines, i - 1), *b = array_get(&lines, state % i);
+			LineRef tmp = *a;
+			*a = *b;
+			*b = tmp;
+		}
+		break;
+	}
+	bool ret = lines_put(win, sel, range, &lines, newline);
+	array_release(&lines);
+	free(data);
+	return ret;
+}
+
 static bool print_keylayout(const char *key, void *value, void *data) {
 	return text_appendf(data, "  %-18s\t%s\n", key[0] == ' ' ? "␣" : key, (char*)value);
 }
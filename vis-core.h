@@ -2,6 +2,8 @@
 #define VIS_CORE_H
 
 #include <setjmp.h>
+#include <sys/types.h>
+#include <sys/select.h>
 #include "vis.h"
 #include "sam.h"
 #include "vis-lua.h"
@@ -40,8 +42,14 @@ struct Mode {
 
 typedef struct {
 	Array values;
+	Array slices;  /* TextSlice* referencing the content of a slot, NULL if it is stored in values */
 	bool linewise; /* place register content on a new line when inserting? */
 	bool append;
+	size_t synced;  /* vis->waits when a clipboard register was last read or written, see clipboard_synced */
+	bool usable;    /* whether vis-clipboard(1) was found to support this clipboard register */
+	pid_t copy_pid; /* background process copying to this clipboard register, 0 if none */
+	int copy_fd;    /* reading end of its error output */
+	Buffer copy_err; /* error output received so far */
 	enum {
 		REGISTER_NORMAL,
 		REGISTER_NUMBER,
@@ -150,6 +158,9 @@ struct File { /* shared state among windows displaying the same file */
 	Array marks[VIS_MARK_INVALID];   /* marks which are shared across windows */
 	enum TextSaveMethod save_method; /* whether the file is saved using rename(2) or overwritten */
 	Transcript transcript;           /* keeps track of changes performed by sam commands */
+	char *journal;                   /* name of the journal recording unsaved changes, NULL if none */
+	int watch_file, watch_dir;       /* inotify(7) watch descriptors for the file and its directory, -1 if none */
+	bool changed;                    /* whether a change notification for the file is pending */
 	File *next, *prev;
 };
 
@@ -222,6 +233,16 @@ struct Vis {
 	Array textobjects;
 	Array bindings;
 	bool ignorecase;                     /* whether to ignore case when searching */
+	bool journal;                        /* whether to record unsaved changes for crash recovery */
+	bool autoreload;                     /* whether to reload unmodified files when they change on disk */
+	bool undofile;                       /* whether to preserve the undo history across editing sessions */
+	size_t undolevels;                   /* maximal number of revisions kept per file, zero if unlimited */
+	size_t undosize;                     /* maximal number of bytes kept for undo per file, zero if unlimited */
+	size_t undomemory;                   /* history growth after which its data is paged out, zero if never */
+	char *undodir;                       /* directory for undo history and paged out data, NULL for defaults */
+	int inotify;                         /* inotify(7) instance watching all open files, -1 if unavailable */
+	struct timespec changed_time;        /* when the oldest pending change notification was received */
+	size_t waits;                        /* how often the main loop waited for events, starting at one */
 };
 
 enum VisEvents {
@@ -275,6 +296,10 @@ char *absolute_path(const char *path);
 
 const char *file_name_get(File*);
 void file_name_set(File*, const char *name);
+void file_journal_open(Vis*, File*);
+void file_journal_close(File*);
+void file_history_save(Vis*, File*);
+void file_watch(Vis*, File*);
 
 bool register_init(Register*);
 void register_release(Register*);
@@ -287,6 +312,10 @@ void marklist_release(MarkList*);
 
 const char *register_get(Vis*, Register*, size_t *len);
 const char *register_slot_get(Vis*, Register*, size_t slot, size_t *len);
+/* Referenced text content of a slot, if any. Takes precedence over its value. */
+const TextSlice *register_slot_slice(Register*, size_t slot);
+/* Value of a slot with any referenced text content copied into it. */
+Buffer *register_slot_buffer(Register*, size_t slot);
 
 bool register_put0(Vis*, Register*, const char *data);
 bool register_put(Vis*, Register*, const char *data, size_t len);
@@ -296,6 +325,17 @@ bool register_put_range(Vis*, Register*, Text*, Filerange*);
 bool register_slot_put_range(Vis*, Register*, size_t slot, Text*, Filerange*);
 
 size_t vis_register_count(Vis*, Register*);
+/* Pipe the given range to an external command without waiting for it to
+ * complete. Its output is discarded, while its error output can be read
+ * from the descriptor stored in err. Returns the process which has to be
+ * waited for, it exits with the status of the command, or -1 on failure. */
+pid_t vis_pipe_async(Vis*, File*, Filerange*, const char *argv[], int *err);
+/* Add the error output of background clipboard copies to the descriptor set,
+ * returns the highest descriptor. */
+int register_copy_watch(Vis*, fd_set*, int nfds);
+/* Process available error output, report failed copies once they completed.
+ * Returns whether any descriptor of the set was handled. */
+bool register_copy_check(Vis*, fd_set*);
 bool register_resize(Register*, size_t count);
 
 #endif
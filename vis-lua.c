@@ -1322,25 +1322,37 @@ static int exit_func(lua_State *L) {
 }
 
 /***
- * Pipe file range to external process and collect output.
+ * Pipe file range or string to external process and collect output.
  *
  * The editor core will be blocked while the external process is running.
  *
  * @function pipe
- * @tparam File file the file to which the range applies
- * @tparam Range range the range to pipe
+ * @tparam[opt] File file the file to which the range applies
+ * @tparam[opt] Range range the range to pipe
+ * @tparam[opt] string text the data to pipe, used instead of a file range
  * @tparam string command the command to execute
  * @treturn int code the exit status of the executed command
  * @treturn string stdout the data written to stdout
  * @treturn string stderr the data written to stderr
+ * @usage
+ * vis:pipe(file, file:text_object_word(pos), "tr a-z A-Z")
+ * vis:pipe("foo\nbar\n", "sort -r")
  */
 static int pipe_func(lua_State *L) {
 	Vis *vis = obj_ref_check(L, 1, "vis");
-	File *file = obj_ref_check(L, 2, VIS_LUA_TYPE_FILE);
-	Filerange range = getrange(L, 3);
-	const char *cmd = luaL_checkstring(L, 4);
 	char *out = NULL, *err = NULL;
-	int status = vis_pipe_collect(vis, file, &range, (const char*[]){ cmd, NULL }, &out, &err);
+	int status;
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t len;
+		const char *text = lua_tolstring(L, 2, &len);
+		const char *cmd = luaL_checkstring(L, 3);
+		status = vis_pipe_buf_collect(vis, text, len, (const char*[]){ cmd, NULL }, &out, &err);
+	} else {
+		File *file = obj_ref_check(L, 2, VIS_LUA_TYPE_FILE);
+		Filerange range = getrange(L, 3);
+		const char *cmd = luaL_checkstring(L, 4);
+		status = vis_pipe_collect(vis, file, &range, (const char*[]){ cmd, NULL }, &out, &err);
+	}
 	lua_pushinteger(L, status);
 	if (out)
 		lua_pushstring(L, out);
@@ -2097,6 +2109,10 @@ static const struct luaL_Reg window_selection_funcs[] = {
  * File state.
  * @tfield bool modified whether the file contains unsaved changes
  */
+/***
+ * File usage.
+ * @tfield bool internal whether the file is used internally e.g. by the command prompt
+ */
 static int file_index(lua_State *L) {
 	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
 
@@ -2126,6 +2142,11 @@ static int file_index(lua_State *L) {
 			lua_pushboolean(L, text_modified(file->text));
 			return 1;
 		}
+
+		if (strcmp(key, "internal") == 0) {
+			lua_pushboolean(L, file->internal);
+			return 1;
+		}
 	}
 
 	return index_common(L);
@@ -2301,6 +2322,53 @@ static int file_mark_get(lua_State *L) {
 	return 1;
 }
 
+/***
+ * Coalesce fragmented file content.
+ *
+ * Replaces runs of small pieces, as created by many scattered edits, with
+ * contiguous copies. Marks remain valid and the operation is undone together
+ * with the most recent change. This is also done automatically when idle.
+ * @function defragment
+ * @tparam[opt] bool force defragment even if the content is not considered fragmented
+ * @treturn bool whether the content was defragmented, fails if a redo is possible
+ */
+static int file_defragment(lua_State *L) {
+	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	bool force = lua_toboolean(L, 2);
+	lua_pushboolean(L, text_defragment(file->text, force));
+	return 1;
+}
+
+static bool file_words_add(const char *word, size_t count, void *data) {
+	lua_State *L = data;
+	lua_pushunsigned(L, count);
+	lua_setfield(L, -2, word);
+	return true;
+}
+
+/***
+ * Get the words of the file.
+ *
+ * The underlying index is maintained incrementally, only the parts of
+ * the file modified since the last call are rescanned.
+ * @function words
+ * @tparam[opt] string prefix only return words starting with it
+ * @treturn {string=int,...} the number of occurrences of every word,
+ *   `nil` if the index could not be built
+ * @usage
+ * for word, count in pairs(vis.win.file:words("fo")) do
+ * 	-- e.g. foo, 2
+ * end
+ */
+static int file_words(lua_State *L) {
+	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	const char *prefix = luaL_optstring(L, 2, "");
+	lua_newtable(L);
+	if (!text_words(file->text, prefix, file_words_add, L))
+		lua_pushnil(L);
+	return 1;
+}
+
 /***
  * Word text object.
  *
@@ -2340,6 +2408,8 @@ static const struct luaL_Reg file_funcs[] = {
 	{ "content", file_content },
 	{ "mark_set", file_mark_set },
 	{ "mark_get", file_mark_get },
+	{ "defragment", file_defragment },
+	{ "words", file_words },
 	{ NULL, NULL },
 };
 
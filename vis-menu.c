@@ -31,6 +31,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +51,9 @@
 #define MIN(a,b)      ((a) < (b) ? (a) : (b))
 #define MAX(a,b)      ((a) > (b) ? (a) : (b))
 
+#define ARENA_SIZE    (1 << 20) /* allocation granularity of item storage */
+#define READ_BATCH    16        /* reads of pending input before redrawing */
+
 typedef enum {
 	C_Normal,
 	C_Reverse
@@ -56,6 +63,9 @@ typedef struct Item Item;
 struct Item {
 	char *text;
 	Item *left, *right;
+	uint64_t chars; /* set of (case folded) bytes occuring in text */
+	int score;      /* fuzzy match score of last query */
+	size_t index;   /* position in input */
 };
 
 static char   text[BUFSIZ] = "";
@@ -65,11 +75,27 @@ static size_t lines = 0;
 static size_t inputw, promptw;
 static size_t cursor;
 static char  *prompt = NULL;
-static Item  *items = NULL;
+static Item **items = NULL;      /* items in input order, stored in arena */
+static size_t nitems = 0, itemsize = 0;
+static Item **candidates = NULL; /* items matching the last query, in no particular order */
+static size_t ncandidates = 0;
+static char  *arena = NULL;      /* current chunk of item storage */
+static size_t arenafree = 0;
+static char  *pending = NULL;    /* incomplete last line of input */
+static size_t npending = 0, pendingsize = 0;
+static int    infd = -1;         /* file descriptor items are read from */
+static const char *maxstr = NULL;
+static size_t maxlen = 0;
+static char   query[sizeof text]; /* tokenized copy of last query */
+static char **tokv = NULL;
+static int    tokc = 0, tokn = 0;
+static uint64_t tokchars = 0;     /* set of bytes occuring in tokens */
 static Item  *matches, *matchend;
 static Item  *prev, *curr, *next, *sel;
 static struct termios tio_old, tio_new;
 static int  (*fstrncmp)(const char *, const char *, size_t) = strncmp;
+static bool   icase = false;
+static bool   fuzzy = false;
 
 static void
 appenditem(Item *item, Item **list, Item **last) {
@@ -205,42 +231,134 @@ drawmenu(void) {
 	fflush(stderr);
 }
 
+static uint64_t
+charset(const char *s) {
+	uint64_t set = 0;
+	for (; *s; s++)
+		set |= (uint64_t)1 << (tolower((unsigned char)*s) & 63);
+	return set;
+}
+
+static bool
+fchreq(char c1, char c2) {
+	if (icase)
+		return tolower((unsigned char)c1) == tolower((unsigned char)c2);
+	return c1 == c2;
+}
+
 static char*
 fstrstr(const char *s, const char *sub) {
+	if (!icase)
+		return strstr(s, sub);
 	for (size_t len = strlen(sub); *s; s++)
-		if (!fstrncmp(s, sub, len))
+		if (fchreq(*s, *sub) && !fstrncmp(s, sub, len))
 			return (char*)s;
 	return NULL;
 }
 
-static void
-match(void)
-{
-	static char **tokv = NULL;
-	static int tokn = 0;
+static int
+bonus(const char *s, const char *p) {
+	if (p == s)
+		return 16;
+	if (strchr("/._- ", p[-1]))
+		return 8;
+	if (islower((unsigned char)p[-1]) && isupper((unsigned char)*p))
+		return 6;
+	return 0;
+}
+
+/* Score sub as a subsequence of s starting at the first character of sub
+ * found at p, return INT_MIN if there is no such match. Characters at word
+ * boundaries are rewarded and consecutive characters inherit the bonus of
+ * the first one, gaps are penalized. */
+static int
+fuzzymatch(const char *s, const char *p, const char *sub) {
+	int score = 0, chunk = 0, gap = 0;
+	for (const char *q = sub; *q; p++) {
+		if (!*p)
+			return INT_MIN;
+		if (!fchreq(*p, *q)) {
+			gap++;
+			continue;
+		}
+		int b = bonus(s, p);
+		if (q == sub || gap) {
+			score -= gap ? 2 + gap : 0;
+			chunk = b;
+		} else {
+			b = MAX(MAX(b, chunk), 4);
+		}
+		score += 16 + b;
+		gap = 0;
+		q++;
+	}
+	return score;
+}
+
+/* Return the best score among all occurences of sub as a subsequence of s,
+ * INT_MIN if there are none. */
+static int
+fuzzyscore(const char *s, const char *sub) {
+	int best = INT_MIN;
+	for (const char *p = s; *p; p++) {
+		if (!fchreq(*p, *sub))
+			continue;
+		int score = fuzzymatch(s, p, sub);
+		if (score == INT_MIN)
+			break; /* no later start will match either */
+		best = MAX(best, score);
+	}
+	return best;
+}
 
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
+static int
+scorecmp(const void *a, const void *b) {
+	const Item *i1 = *(const Item**)a, *i2 = *(const Item**)b;
+	if (i1->score != i2->score)
+		return i1->score < i2->score ? 1 : -1;
+	/* preserve input order among equally ranked items */
+	return i1->index < i2->index ? -1 : i1->index > i2->index;
+}
+
+static bool
+matchitem(Item *item) {
+	int i;
+	/* quickly reject items missing some of the query characters */
+	if ((item->chars & tokchars) != tokchars)
+		return false;
+	item->score = 0;
+	for (i = 0; i < tokc; i++) {
+		if (fuzzy) {
+			int score = fuzzyscore(item->text, tokv[i]);
+			if (score == INT_MIN)
+				return false;
+			item->score += score;
+		} else if (!fstrstr(item->text, tokv[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+rank(void) {
 	size_t len, textsize;
 	Item *item, *lprefix, *lsubstr, *prefixend, *substrend;
 
-	strcpy(buf, text);
-	/* separate input text into tokens to be matched individually */
-	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
-		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
-			die("Can't realloc.");
 	len = tokc ? strlen(tokv[0]) : 0;
-
 	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
 	textsize = strlen(text) + 1;
-	for (item = items; item && item->text; item++) {
-		for (i = 0; i < tokc; i++)
-			if (!fstrstr(item->text, tokv[i]))
-				break;
-		if (i != tokc) /* not all tokens match */
-			continue;
+	if (fuzzy && tokc) {
+		/* exact matches go first, then order by descending score */
+		for (size_t c = 0; c < ncandidates; c++)
+			if (!fstrncmp(text, candidates[c]->text, textsize))
+				candidates[c]->score = INT_MAX;
+		qsort(candidates, ncandidates, sizeof *candidates, scorecmp);
+	}
+	for (size_t c = 0; c < ncandidates; c++) {
+		item = candidates[c];
 		/* exact matches go first, then prefixes, then substrings */
-		if (!tokc || !fstrncmp(text, item->text, textsize))
+		if (fuzzy || !tokc || !fstrncmp(text, item->text, textsize))
 			appenditem(item, &matches, &matchend);
 		else if (!fstrncmp(tokv[0], item->text, len))
 			appenditem(item, &lprefix, &prefixend);
@@ -263,10 +381,55 @@ match(void)
 			matches = lsubstr;
 		matchend = substrend;
 	}
+}
+
+static void
+match(void)
+{
+	static char last[sizeof text];
+
+	char *s;
+	size_t count, n = 0;
+	Item *item;
+
+	strcpy(query, text);
+	/* separate input text into tokens to be matched individually */
+	tokc = 0;
+	for (s = strtok(query, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
+		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
+			die("Can't realloc.");
+	tokchars = 0;
+	for (int i = 0; i < tokc; i++)
+		tokchars |= charset(tokv[i]);
+
+	/* if the query was extended, only previous matches can still match */
+	bool narrow = last[0] && !strncmp(text, last, strlen(last));
+	count = narrow ? ncandidates : nitems;
+	for (size_t c = 0; c < count; c++) {
+		item = narrow ? candidates[c] : items[c];
+		if (matchitem(item))
+			candidates[n++] = item;
+	}
+	ncandidates = n;
+	strcpy(last, text);
+
+	rank();
 	curr = sel = matches;
 	calcoffsets();
 }
 
+/* add items read since the last query to the matches, keep selection */
+static void
+matchnew(size_t first) {
+	Item *prevsel = sel != matches ? sel : NULL;
+	for (size_t i = first; i < nitems; i++)
+		if (matchitem(items[i]))
+			candidates[ncandidates++] = items[i];
+	rank();
+	curr = sel = prevsel ? prevsel : matches;
+	calcoffsets();
+}
+
 static void
 insert(const char *str, ssize_t n) {
 	if (strlen(text) + n > sizeof text - 1)
@@ -278,6 +441,20 @@ insert(const char *str, ssize_t n) {
 	match();
 }
 
+/* replace the input by s, truncated to fit without splitting a character */
+static void
+settext(const char *s) {
+	size_t len = strlen(s);
+	if (len > sizeof text - 1) {
+		len = sizeof text - 1;
+		while (len > 0 && (s[len] & 0xc0) == 0x80)
+			len--;
+	}
+	memcpy(text, s, len);
+	text[len] = '\0';
+	cursor = len;
+}
+
 static size_t
 nextrune(int inc) {
 	ssize_t n;
@@ -286,25 +463,119 @@ nextrune(int inc) {
 	return n;
 }
 
+static void*
+arenaalloc(size_t size) {
+	size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	if (size > arenafree) {
+		arenafree = MAX(size, ARENA_SIZE);
+		if (!(arena = malloc(arenafree)))
+			die("Can't malloc.");
+	}
+	void *p = arena;
+	arena += size;
+	arenafree -= size;
+	return p;
+}
+
+static void
+additem(const char *s, size_t len) {
+	if (nitems == itemsize) {
+		itemsize = itemsize ? 2*itemsize : 1024;
+		if (!(items = realloc(items, itemsize * sizeof *items)) ||
+		    !(candidates = realloc(candidates, itemsize * sizeof *candidates)))
+			die("Can't realloc.");
+	}
+	Item *item = arenaalloc(sizeof *item + len + 1);
+	item->text = (char*)(item + 1);
+	memcpy(item->text, s, len);
+	item->text[len] = '\0';
+	item->chars = charset(item->text);
+	item->index = nitems;
+	items[nitems++] = item;
+	if (len > maxlen)
+		maxlen = textw(maxstr = item->text);
+}
+
 static void
-readstdin() {
-	char buf[sizeof text], *p, *maxstr = NULL;
-	size_t i, max = 0, size = 0;
-
-	for(i = 0; fgets(buf, sizeof buf, stdin); i++) {
-		if (i+1 >= size / sizeof *items)
-			if (!(items = realloc(items, (size += BUFSIZ))))
-				die("Can't realloc.");
-		if ((p = strchr(buf, '\n')))
-			*p = '\0';
-		if (!(items[i].text = strdup(buf)))
-			die("Can't strdup.");
-		if (strlen(items[i].text) > max)
-			max = textw(maxstr = items[i].text);
+addpending(const char *s, size_t len) {
+	if (!len)
+		return;
+	if (npending + len > pendingsize) {
+		pendingsize = MAX(npending + len, 2*pendingsize);
+		if (!(pending = realloc(pending, pendingsize)))
+			die("Can't realloc.");
+	}
+	memcpy(pending + npending, s, len);
+	npending += len;
+}
+
+/* read available input, returns false once all items were read */
+static bool
+readitems(void) {
+	char buf[1 << 16], *s, *end, *nl;
+	ssize_t n = read(infd, buf, sizeof buf);
+	if (n == -1 && (errno == EINTR || errno == EAGAIN))
+		return true;
+	if (n <= 0) {
+		if (npending)
+			additem(pending, npending);
+		free(pending);
+		pending = NULL;
+		npending = pendingsize = 0;
+		close(infd);
+		infd = -1;
+		return false;
+	}
+	for (s = buf, end = buf + n; (nl = memchr(s, '\n', end - s)); s = nl + 1) {
+		if (npending) {
+			addpending(s, nl - s);
+			additem(pending, npending);
+			npending = 0;
+		} else {
+			additem(s, nl - s);
+		}
+	}
+	addpending(s, end - s);
+	return true;
+}
+
+/* display items as they are read until keyboard input is available */
+static void
+waitinput(void) {
+	struct pollfd fds[] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = infd, .events = POLLIN },
+	};
+	size_t first = nitems;
+	int reads = 0;
+
+	while (infd != -1) {
+		fds[1].fd = infd;
+		int r = poll(fds, 2, reads ? 0 : -1);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r == -1)
+			die("Can't poll.");
+		if (fds[1].revents && !fds[0].revents && reads < READ_BATCH) {
+			readitems();
+			reads++;
+			continue;
+		}
+		if (nitems != first) {
+			inputw = MIN(textw(maxstr), mw/3);
+			matchnew(first);
+			drawmenu();
+			first = nitems;
+		}
+		if (fds[0].revents)
+			return;
+		reads = 0;
+	}
+	if (nitems != first) {
+		inputw = MIN(textw(maxstr), mw/3);
+		matchnew(first);
+		drawmenu();
 	}
-	if (items)
-		items[i].text = NULL;
-	inputw = textw(maxstr);
 }
 
 static void
@@ -352,7 +623,7 @@ setup(void) {
 
 	lines = MIN(MAX(lines, 0), mh);
 	promptw = prompt ? textw(prompt) : 0;
-	inputw = MIN(inputw, mw/3);
+	inputw = MIN(textw(maxstr), mw/3);
 	match();
 	if (barpos != 0) resetline();
 	drawmenu();
@@ -364,6 +635,7 @@ run(void) {
 	char c;
 
 	for (;;) {
+		waitinput();
 		xread(0, &c, 1);
 		memset(buf, '\0', sizeof buf);
 		buf[0] = c;
@@ -462,10 +734,15 @@ run(void) {
 			return 1;
 		case CONTROL('M'): /* Return */
 		case CONTROL('J'):
-			if (sel) strncpy(text, sel->text, sizeof(text)-1); /* Complete the input first, when hitting return */
-			cursor = strlen(text);
-			match();
-			drawmenu();
+			if (sel) { /* Complete the input first, when hitting return */
+				const char *item = sel->text;
+				settext(item);
+				match();
+				drawmenu();
+				/* the input might not hold all of it */
+				puts(item);
+				return 0;
+			}
 			/* fallthrough */
 		case CONTROL(']'):
 		case CONTROL('\\'): /* These are usually close enough to RET to replace Shift+RET, again due to console limitations */
@@ -532,8 +809,7 @@ run(void) {
 		case CONTROL('I'): /* TAB */
 			if (!sel)
 				break;
-			strncpy(text, sel->text, sizeof text);
-			cursor = strlen(text);
+			settext(sel->text);
 			match();
 			break;
 		case CONTROL('K'):
@@ -566,7 +842,7 @@ run(void) {
 
 static void
 usage(void) {
-	fputs("usage: vis-menu [-b|-t] [-i] [-l lines] [-p prompt] [initial selection]\n", stderr);
+	fputs("usage: vis-menu [-b|-t] [-i] [-F] [-l lines] [-p prompt] [initial selection]\n", stderr);
 	exit(2);
 }
 
@@ -578,13 +854,15 @@ main(int argc, char **argv) {
 			exit(0);
 		} else if (!strcmp(argv[i], "-i")) {
 			fstrncmp = strncasecmp;
+			icase = true;
+		} else if (!strcmp(argv[i], "-F")) {
+			fuzzy = true;
 		} else if (!strcmp(argv[i], "-t")) {
 			barpos = +1;
 		} else if (!strcmp(argv[i], "-b")) {
 			barpos = -1;
 		} else if (argv[i][0] != '-') {
-			strncpy(text, argv[i], sizeof(text)-1);
-			cursor = strlen(text);
+			settext(argv[i]);
 		} else if (i + 1 == argc) {
 			usage();
 		} else if (!strcmp(argv[i], "-p")) {
@@ -601,7 +879,10 @@ main(int argc, char **argv) {
 		}
 	}
 
-	readstdin();
+	/* keep reading items while the menu is displayed, unless they are typed */
+	infd = dup(STDIN_FILENO);
+	if (infd != -1 && isatty(infd))
+		while (readitems());
 	setup();
 	int status = run();
 	cleanup();
@@ -63,16 +63,45 @@ static size_t op_put(Vis *vis, Text *txt, OperatorContext *c) {
 	}
 
 	size_t len;
-	const char *data = register_slot_get(vis, c->reg, c->reg_slot, &len);
-
-	for (int i = 0; i < c->count; i++) {
-		char nl;
-		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
-			pos += text_insert(txt, pos, "\n", 1);
-		text_insert(txt, pos, data, len);
-		pos += len;
-		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
+	const char *data = NULL;
+	const TextSlice *slice = register_slot_slice(c->reg, c->reg_slot);
+	if (slice)
+		len = text_slice_size(slice);
+	else
+		data = register_slot_get(vis, c->reg, c->reg_slot, &len);
+
+	char nl;
+	size_t count = c->count > 0 ? c->count : 0;
+	if (count > 0 && c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
+		pos += text_insert(txt, pos, "\n", 1);
+	/* linewise content lacking a trailing newline is terminated by one */
+	bool newline = false;
+	if (c->reg->linewise && len > 0) {
+		if (slice)
+			text_slice_bytes_get(slice, len-1, 1, &nl);
+		else
+			nl = data[len-1];
+		newline = nl != '\n';
+	}
+	if (slice && newline) {
+		for (size_t i = 0; i < count; i++) {
+			text_insert_slice(txt, pos, slice, 1);
+			pos += len;
 			pos += text_insert(txt, pos, "\n", 1);
+		}
+	} else if (slice) {
+		text_insert_slice(txt, pos, slice, count);
+		pos += len * count;
+	} else if (newline) {
+		Buffer line;
+		buffer_init(&line);
+		if (buffer_put(&line, data, len) && buffer_append(&line, "\n", 1) &&
+		    text_insert_repeat(txt, pos, buffer_content(&line), len+1, count))
+			pos += (len+1) * count;
+		buffer_release(&line);
+	} else {
+		text_insert_repeat(txt, pos, data, len, count);
+		pos += len * count;
 	}
 
 	if (c->reg->linewise) {
@@ -100,45 +129,73 @@ static size_t op_put(Vis *vis, Text *txt, OperatorContext *c) {
 	return pos;
 }
 
+#define blank(c) ((c) == ' ' || (c) == '\t')
+
+/* Apply the edits, ordered by position, as one change. Falls back to
+ * individual modifications if that fails. */
+static void edits_apply(Text *txt, Array *edits) {
+	size_t count = array_length(edits);
+	if (count == 0 || text_edit(txt, array_get(edits, 0), count))
+		return;
+	for (size_t i = count; i-- > 0;) {
+		TextEdit *e = array_get(edits, i);
+		text_delete(txt, e->pos, e->del);
+		text_insert(txt, e->pos, e->data, e->len);
+	}
+}
+
+/* Determine the begin of the first and last line affected by a shift */
+static size_t shift_lines(Text *txt, OperatorContext *c, size_t *last) {
+	size_t pos = text_line_begin(txt, c->range.end);
+	/* if range ends at the begin of a line, skip line break */
+	if (pos == c->range.end)
+		pos = text_line_prev(txt, pos);
+	*last = text_line_begin(txt, pos);
+	return MIN(text_line_begin(txt, c->range.start), *last);
+}
+
 static size_t op_shift_right(Vis *vis, Text *txt, OperatorContext *c) {
 	char spaces[9] = "         ";
 	spaces[MIN(vis->tabwidth, LENGTH(spaces) - 1)] = '\0';
 	const char *tab = vis->expandtab ? spaces : "\t";
-	size_t tablen = strlen(tab);
-	size_t pos = text_line_begin(txt, c->range.end), prev_pos;
+	size_t tablen = strlen(tab), last;
+	size_t first = shift_lines(txt, c, &last);
+	bool multiple_lines = text_line_prev(txt, last) >= c->range.start;
 	size_t newpos = c->pos;
+	Array edits;
+	array_init_sized(&edits, sizeof(TextEdit));
 
-	/* if range ends at the begin of a line, skip line break */
-	if (pos == c->range.end)
-		pos = text_line_prev(txt, pos);
-	bool multiple_lines = text_line_prev(txt, pos) >= c->range.start;
-
-	do {
-		size_t end = text_line_end(txt, pos);
-		prev_pos = pos = text_line_begin(txt, end);
-		if ((!multiple_lines || pos != end) &&
-		    text_insert(txt, pos, tab, tablen) && pos <= c->pos)
-			newpos += tablen;
-		pos = text_line_prev(txt, pos);
-	}  while (pos >= c->range.start && pos != prev_pos);
+	for (Iterator it = text_iterator_get(txt, first);;) {
+		char b;
+		size_t pos = it.pos;
+		bool empty = pos == text_size(txt) || (text_iterator_byte_get(&it, &b) && b == '\n');
+		if (!multiple_lines || !empty) {
+			TextEdit e = { .pos = pos, .data = tab, .len = tablen };
+			if (!array_add(&edits, &e))
+				break;
+			if (pos <= c->pos)
+				newpos += tablen;
+		}
+		if (pos >= last || !text_iterator_byte_find_next(&it, '\n'))
+			break;
+		text_iterator_byte_next(&it, NULL);
+	}
 
+	edits_apply(txt, &edits);
+	array_release(&edits);
 	return newpos;
 }
 
 static size_t op_shift_left(Vis *vis, Text *txt, OperatorContext *c) {
-	size_t pos = text_line_begin(txt, c->range.end), prev_pos;
-	size_t tabwidth = vis->tabwidth, tablen;
+	size_t tabwidth = vis->tabwidth, tablen, last;
+	size_t first = shift_lines(txt, c, &last);
 	size_t newpos = c->pos;
+	Array edits;
+	array_init_sized(&edits, sizeof(TextEdit));
 
-	/* if range ends at the begin of a line, skip line break */
-	if (pos == c->range.end)
-		pos = text_line_prev(txt, pos);
-
-	do {
+	for (Iterator it = text_iterator_get(txt, first);;) {
 		char b;
-		size_t len = 0;
-		prev_pos = pos = text_line_begin(txt, pos);
-		Iterator it = text_iterator_get(txt, pos);
+		size_t len = 0, pos = it.pos;
 		if (text_iterator_byte_get(&it, &b) && b == '\t') {
 			len = 1;
 		} else {
@@ -146,17 +203,26 @@ static size_t op_shift_left(Vis *vis, Text *txt, OperatorContext *c) {
 				text_iterator_byte_next(&it, NULL);
 		}
 		tablen = MIN(len, tabwidth);
-		if (text_delete(txt, pos, tablen) && pos < c->pos) {
-			size_t delta = c->pos - pos;
-			if (delta > tablen)
-				delta = tablen;
-			if (delta > newpos)
-				delta = newpos;
-			newpos -= delta;
+		if (tablen > 0) {
+			TextEdit e = { .pos = pos, .del = tablen };
+			if (!array_add(&edits, &e))
+				break;
+			if (pos < c->pos) {
+				size_t delta = c->pos - pos;
+				if (delta > tablen)
+					delta = tablen;
+				if (delta > newpos)
+					delta = newpos;
+				newpos -= delta;
+			}
 		}
-		pos = text_line_prev(txt, pos);
-	}  while (pos >= c->range.start && pos != prev_pos);
+		if (pos >= last || !text_iterator_byte_find_next(&it, '\n'))
+			break;
+		text_iterator_byte_next(&it, NULL);
+	}
 
+	edits_apply(txt, &edits);
+	array_release(&edits);
 	return newpos;
 }
 
@@ -175,8 +241,7 @@ static size_t op_cursor(Vis *vis, Text *txt, OperatorContext *c) {
 }
 
 static size_t op_join(Vis *vis, Text *txt, OperatorContext *c) {
-	size_t pos = text_line_begin(txt, c->range.end), prev_pos;
-	Mark mark = EMARK;
+	size_t pos = text_line_begin(txt, c->range.end);
 
 	/* if operator and range are both linewise, skip last line break */
 	if (c->linewise && text_range_is_linewise(txt, &c->range)) {
@@ -186,25 +251,61 @@ static size_t op_join(Vis *vis, Text *txt, OperatorContext *c) {
 			pos = line_prev;
 	}
 
+	/* all line breaks up to the begin of the last line are joined */
+	size_t last = text_line_begin(txt, pos);
 	size_t len = c->arg->s ? strlen(c->arg->s) : 0;
+	Array edits;
+	array_init_sized(&edits, sizeof(TextEdit));
+
+	char b;
+	Iterator it = text_iterator_get(txt, c->range.start);
+	if (c->range.start == 0) {
+		/* at the start of the text, leading blanks are removed */
+		while (text_iterator_byte_get(&it, &b) && blank(b))
+			text_iterator_byte_next(&it, NULL);
+		TextEdit e = { .pos = 0, .del = it.pos };
+		if (e.del > 0)
+			array_add(&edits, &e);
+	}
 
-	do {
-		prev_pos = pos;
-		size_t end = text_line_start(txt, pos);
-		pos = text_line_prev(txt, end);
-		if (pos < c->range.start || end <= pos)
+	/* a separator is inserted unless the joined lines already end or start
+	 * with white space. subsequent blank lines are joined too, the join
+	 * waiting for the decision is the one preceding them. */
+	size_t waiting = EPOS;
+	while (text_iterator_byte_find_next(&it, '\n') && it.pos < last) {
+		char prev, next = '\0';
+		Iterator p = it;
+		TextEdit e = { .pos = it.pos, .data = c->arg->s };
+		bool separate = text_iterator_byte_prev(&p, &prev) && !isspace((unsigned char)prev);
+		while (text_iterator_byte_next(&it, &next) && blank(next));
+		e.del = it.pos - e.pos;
+		if (!array_add(&edits, &e))
 			break;
-		text_delete(txt, pos, end - pos);
-		char prev, next;
-		if (text_byte_get(txt, pos-1, &prev) && !isspace((unsigned char)prev) &&
-		    text_byte_get(txt, pos, &next) && next != '\n')
-			text_insert(txt, pos, c->arg->s, len);
-		if (mark == EMARK)
-			mark = text_mark_set(txt, pos);
-	} while (pos != prev_pos);
-
-	size_t newpos = text_mark_get(txt, mark);
-	return newpos != EPOS ? newpos : c->range.start;
+		if (separate)
+			waiting = array_length(&edits) - 1;
+		if (next == '\n' && it.pos < last)
+			continue;
+		if (waiting != EPOS && next != '\n' && it.pos < text_size(txt)) {
+			TextEdit *w = array_get(&edits, waiting);
+			w->len = len;
+		}
+		waiting = EPOS;
+	}
+
+	edits_apply(txt, &edits);
+
+	/* the cursor is placed at the last join point */
+	size_t newpos = c->range.start, count = array_length(&edits);
+	if (count > 0) {
+		TextEdit *e = array_get(&edits, count - 1);
+		newpos = e->pos;
+		for (size_t i = 0; i < count - 1; i++) {
+			e = array_get(&edits, i);
+			newpos = newpos + e->len - e->del;
+		}
+	}
+	array_release(&edits);
+	return newpos;
 }
 
 static size_t op_modeswitch(Vis *vis, Text *txt, OperatorContext *c) {
@@ -1,8 +1,86 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "vis-core.h"
 
+/* The content of a clipboard register is reused until the main loop waits for
+ * events again, other programs can only change the clipboard in between. This
+ * avoids spawning vis-clipboard(1) for every selection or iteration of a macro.
+ * Copied content is also reused while it is being stored in the background. */
+static bool clipboard_synced(Vis *vis, Register *reg) {
+	return reg->synced && (reg->synced == vis->waits || reg->copy_pid > 0);
+}
+
+/* whether vis-clipboard(1) supports the given selection, only a positive
+ * answer is remembered */
+static bool clipboard_usable(Vis *vis, Register *reg, const char *selection) {
+	if (reg->usable)
+		return true;
+	const char *cmd[] = { VIS_CLIPBOARD, "--usable", "--selection", selection, NULL };
+	int status = vis_pipe(vis, vis->win->file, &(Filerange){ .start = 0, .end = 0 },
+		cmd, NULL, NULL, NULL, NULL);
+	if (status != 0)
+		vis_info_show(vis, "System clipboard not supported, see %s(1)", VIS_CLIPBOARD);
+	return (reg->usable = status == 0);
+}
+
+/* collect error output of a background copy, once it is complete reap the
+ * process and report a failure. returns whether the copy completed */
+static bool register_copy_read(Vis *vis, Register *reg) {
+	char buf[BUFSIZ];
+	ssize_t len = read(reg->copy_fd, buf, sizeof buf);
+	if (len > 0) {
+		buffer_append(&reg->copy_err, buf, len);
+		return false;
+	}
+	if (len == -1 && errno == EINTR)
+		return false;
+	close(reg->copy_fd);
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(reg->copy_pid, &status, 0)) == -1 && errno == EINTR);
+	reg->copy_pid = 0;
+	if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		/* the content might not have made it to the clipboard */
+		reg->synced = 0;
+		if (buffer_length0(&reg->copy_err) > 0)
+			vis_info_show(vis, "Copying to clipboard failed: %s", buffer_content0(&reg->copy_err));
+		else if (pid != -1 && WIFEXITED(status))
+			vis_info_show(vis, "Copying to clipboard failed with exit status %d", WEXITSTATUS(status));
+		else
+			vis_info_show(vis, "Copying to clipboard failed");
+	}
+	buffer_clear(&reg->copy_err);
+	return true;
+}
+
+int register_copy_watch(Vis *vis, fd_set *fds, int nfds) {
+	for (size_t i = 0; i < LENGTH(vis->registers); i++) {
+		Register *reg = &vis->registers[i];
+		if (reg->copy_pid > 0) {
+			FD_SET(reg->copy_fd, fds);
+			nfds = MAX(nfds, reg->copy_fd);
+		}
+	}
+	return nfds;
+}
+
+bool register_copy_check(Vis *vis, fd_set *fds) {
+	bool handled = false;
+	for (size_t i = 0; i < LENGTH(vis->registers); i++) {
+		Register *reg = &vis->registers[i];
+		if (reg->copy_pid > 0 && FD_ISSET(reg->copy_fd, fds)) {
+			register_copy_read(vis, reg);
+			handled = true;
+		}
+	}
+	return handled;
+}
+
 static Buffer *register_buffer(Register *reg, size_t slot) {
 	Buffer *buf = array_get(&reg->values, slot);
 	if (buf)
@@ -21,6 +99,44 @@ static Buffer *register_buffer(Register *reg, size_t slot) {
 	return array_get(&reg->values, slot);
 }
 
+static bool register_slice_set(Register *reg, size_t slot, TextSlice *slice) {
+	TextSlice *old = array_get_ptr(&reg->slices, slot);
+	if (old || slice) {
+		while (array_length(&reg->slices) <= slot && array_add_ptr(&reg->slices, NULL));
+		if (!array_set_ptr(&reg->slices, slot, slice)) {
+			text_slice_free(slice);
+			return false;
+		}
+	}
+	text_slice_free(old);
+	return true;
+}
+
+static void register_resize_slices(Register *reg, size_t count) {
+	for (size_t i = count, len = array_length(&reg->slices); i < len; i++)
+		text_slice_free(array_get_ptr(&reg->slices, i));
+	array_truncate(&reg->slices, count);
+}
+
+const TextSlice *register_slot_slice(Register *reg, size_t slot) {
+	return array_get_ptr(&reg->slices, slot);
+}
+
+Buffer *register_slot_buffer(Register *reg, size_t slot) {
+	Buffer *buf = array_get(&reg->values, slot);
+	TextSlice *slice = array_get_ptr(&reg->slices, slot);
+	if (!buf || !slice)
+		return buf;
+	size_t len = text_slice_size(slice);
+	if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
+		return NULL;
+	buf->len = text_slice_bytes_get(slice, 0, len, buf->data);
+	if (!buffer_append(buf, "\0", 1))
+		return NULL;
+	register_slice_set(reg, slot, NULL);
+	return buf;
+}
+
 static ssize_t read_buffer(void *context, char *data, size_t len) {
 	buffer_append(context, data, len);
 	return len;
@@ -30,6 +146,7 @@ bool register_init(Register *reg) {
 	Buffer buf;
 	buffer_init(&buf);
 	array_init_sized(&reg->values, sizeof(Buffer));
+	array_init(&reg->slices);
 	return array_add(&reg->values, &buf);
 }
 
@@ -40,6 +157,12 @@ void register_release(Register *reg) {
 	for (size_t i = 0; i < n; i++)
 		buffer_release(array_get(&reg->values, i));
 	array_release(&reg->values);
+	register_resize_slices(reg, 0);
+	array_release(&reg->slices);
+	/* a pending copy completes on its own */
+	if (reg->copy_pid > 0)
+		close(reg->copy_fd);
+	buffer_release(&reg->copy_err);
 }
 
 const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len) {
@@ -48,7 +171,7 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
-		Buffer *buf = array_get(&reg->values, slot);
+		Buffer *buf = register_slot_buffer(reg, slot);
 		if (!buf)
 			return NULL;
 		buffer_terminate(buf);
@@ -75,6 +198,13 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 		Buffer *buf = array_get(&reg->values, slot);
 		if (!buf)
 			return NULL;
+		if (clipboard_synced(vis, reg) && (buf = register_slot_buffer(reg, slot))) {
+			if (len)
+				*len = buffer_length0(buf);
+			return buffer_content0(buf);
+		}
+		buf = array_get(&reg->values, slot);
+		register_slice_set(reg, slot, NULL);
 		buffer_clear(buf);
 
 		if (id == VIS_REG_PRIMARY)
@@ -87,6 +217,8 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 
 		if (status != 0)
 			vis_info_show(vis, "Command failed %s", buffer_content0(&buferr));
+		else
+			reg->synced = vis->waits;
 		buffer_release(&buferr);
 		if (len)
 			*len = buffer_length0(buf);
@@ -106,6 +238,7 @@ bool register_slot_put(Vis *vis, Register *reg, size_t slot, const char *data, s
 	if (reg->type != REGISTER_NORMAL)
 		return false;
 	Buffer *buf = register_buffer(reg, slot);
+	register_slice_set(reg, slot, NULL);
 	return buf && buffer_put(buf, data, len);
 }
 
@@ -123,7 +256,7 @@ static bool register_slot_append_range(Register *reg, size_t slot, Text *txt, Fi
 	case REGISTER_NORMAL:
 	{
 		Buffer *buf = register_buffer(reg, slot);
-		if (!buf)
+		if (!buf || !(buf = register_slot_buffer(reg, slot)))
 			return false;
 		size_t len = text_range_size(range);
 		if (len == SIZE_MAX || !buffer_grow(buf, len+1))
@@ -148,6 +281,13 @@ bool register_slot_put_range(Vis *vis, Register *reg, size_t slot, Text *txt, Fi
 		Buffer *buf = register_buffer(reg, slot);
 		if (!buf)
 			return false;
+		/* reference the text instead of copying it, only materialized on demand */
+		TextSlice *slice = text_slice_new(txt, range);
+		if (slice) {
+			buffer_clear(buf);
+			return register_slice_set(reg, slot, slice);
+		}
+		register_slice_set(reg, slot, NULL);
 		size_t len = text_range_size(range);
 		if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
 			return false;
@@ -156,23 +296,31 @@ bool register_slot_put_range(Vis *vis, Register *reg, size_t slot, Text *txt, Fi
 	}
 	case REGISTER_CLIPBOARD:
 	{
-		Buffer buferr;
 		const char *cmd[] = { VIS_CLIPBOARD, "--copy", "--selection", NULL, NULL };
 		enum VisRegister id = reg - vis->registers;
-		buffer_init(&buferr);
 
 		if (id == VIS_REG_PRIMARY)
 			cmd[3] = "primary";
 		else
 			cmd[3] = "clipboard";
 
-		int status = vis_pipe(vis, vis->win->file, range,
-			cmd, NULL, NULL, &buferr, read_buffer);
+		if (!clipboard_usable(vis, reg, cmd[3]))
+			return false;
+		/* the latest copy has to win */
+		while (reg->copy_pid > 0 && !register_copy_read(vis, reg));
 
-		if (status != 0)
-			vis_info_show(vis, "Command failed %s", buffer_content0(&buferr));
-		buffer_release(&buferr);
-		return status == 0;
+		/* subsequent pastes are served from the stored content while
+		 * the clipboard is updated in the background */
+		Buffer *buf = array_get(&reg->values, 0);
+		reg->synced = 0;
+		if (buf) {
+			buffer_clear(buf);
+			if (register_slice_set(reg, 0, text_slice_new(txt, range)) && register_slot_slice(reg, 0))
+				reg->synced = vis->waits;
+		}
+		pid_t pid = vis_pipe_async(vis, vis->win->file, range, cmd, &reg->copy_fd);
+		reg->copy_pid = MAX(pid, 0);
+		return pid != -1;
 	}
 	case REGISTER_BLACKHOLE:
 		return true;
@@ -193,6 +341,7 @@ size_t vis_register_count(Vis *vis, Register *reg) {
 }
 
 bool register_resize(Register *reg, size_t count) {
+	register_resize_slices(reg, count);
 	return array_truncate(&reg->values, count);
 }
 
@@ -262,6 +411,7 @@ bool vis_register_set(Vis *vis, enum VisRegister id, Array *data) {
 		Buffer *buf = register_buffer(reg, i);
 		if (!buf)
 			return false;
+		register_slice_set(reg, i, NULL);
 		TextString *string = array_get(data, i);
 		if (!buffer_put(buf, string->data, string->len))
 			return false;
@@ -277,7 +427,9 @@ Array vis_register_get(Vis *vis, enum VisRegister id) {
 		size_t len = array_length(&reg->values);
 		array_reserve(&data, len);
 		for (size_t i = 0; i < len; i++) {
-			Buffer *buf = array_get(&reg->values, i);
+			Buffer *buf = register_slot_buffer(reg, i);
+			if (!buf)
+				buf = array_get(&reg->values, i);
 			TextString string = {
 				.data = buffer_content(buf),
 				.len = buffer_length(buf),
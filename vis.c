@@ -16,6 +16,9 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
 #include <pwd.h>
 #include <libgen.h>
 #include <termkey.h>
@@ -112,6 +115,9 @@ bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
 
 /** window / file handling */
 
+static void file_unwatch(Vis*, File*);
+static void watch_release(Vis*, int wd);
+
 static void file_free(Vis *vis, File *file) {
 	if (!file)
 		return;
@@ -122,6 +128,8 @@ static void file_free(Vis *vis, File *file) {
 	vis_event_emit(vis, VIS_EVENT_FILE_CLOSE, file);
 	for (size_t i = 0; i < LENGTH(file->marks); i++)
 		mark_release(&file->marks[i]);
+	file_journal_close(file);
+	file_unwatch(vis, file);
 	text_free(file->text);
 	free((char*)file->name);
 
@@ -139,8 +147,11 @@ static File *file_new_text(Vis *vis, Text *text) {
 	if (!file)
 		return NULL;
 	file->fd = -1;
+	file->watch_file = file->watch_dir = -1;
 	file->text = text;
 	file->stat = text_stat(text);
+	text_history_limit(text, vis->undolevels, vis->undosize);
+	text_history_page(text, vis->undomemory, vis->undodir);
 	for (size_t i = 0; i < LENGTH(file->marks); i++)
 		mark_init(&file->marks[i]);
 	if (vis->files)
@@ -231,6 +242,242 @@ void file_name_set(File *file, const char *name) {
 	file->name = absolute_path(name);
 }
 
+/* auxiliary files of `/path/to/file` are stored as `/path/to/.file.vis.ext` */
+static char *file_aux_name(const char *name, const char *ext) {
+	char *copy1 = strdup(name);
+	char *copy2 = strdup(name);
+	char *aux = NULL;
+	if (copy1 && copy2) {
+		char *dir = dirname(copy1);
+		char *base = basename(copy2);
+		size_t len = strlen(dir) + strlen(base) + strlen(ext) + sizeof "/..vis.";
+		if ((aux = malloc(len)))
+			snprintf(aux, len, "%s/.%s.vis.%s", dir, base, ext);
+	}
+	free(copy1);
+	free(copy2);
+	return aux;
+}
+
+static char *file_journal_name(const char *name) {
+	return file_aux_name(name, "journal");
+}
+
+/* report the journal of an incremental save which did not complete */
+static void file_save_interrupted(Vis *vis, File *file) {
+	if (!file->name || file->internal)
+		return;
+	char *journal = file_aux_name(file->name, "save");
+	if (journal && access(journal, F_OK) == 0)
+		vis_info_show(vis, "Saving `%s' was interrupted, use `vis -r' to restore its previous content", file_name_get(file));
+	free(journal);
+}
+
+/* start recording changes of a file whose content matches the one on
+ * disk, restarts an existing journal e.g. after the file was saved */
+void file_journal_open(Vis *vis, File *file) {
+	if (!vis->journal && !file->journal)
+		return;
+	if (!file->name || file->internal || text_modified(file->text))
+		return;
+	char *journal = file->journal ? file->journal : file_journal_name(file->name);
+	if (!journal)
+		return;
+	if (text_journal_open(file->text, journal)) {
+		file->journal = journal;
+		return;
+	}
+	if (errno == EEXIST)
+		vis_info_show(vis, "Journal `%s' exists, use `vis -r' to recover unsaved changes", journal);
+	else
+		vis_info_show(vis, "Can't create journal `%s': %s", journal, strerror(errno));
+	if (journal == file->journal)
+		file_journal_close(file);
+	else
+		free(journal);
+}
+
+void file_journal_close(File *file) {
+	if (!file->journal)
+		return;
+	text_journal_close(file->text);
+	free(file->journal);
+	file->journal = NULL;
+}
+
+/* the undo history is stored alongside the file, or within undodir using the
+ * absolute path of the file with all slashes replaced by percent signs */
+static char *file_history_name(Vis *vis, const char *name) {
+	if (!vis->undodir)
+		return file_aux_name(name, "undo");
+	size_t len = strlen(vis->undodir) + strlen(name) + sizeof "/";
+	char *history = malloc(len);
+	if (!history)
+		return NULL;
+	snprintf(history, len, "%s/%s", vis->undodir, name);
+	for (char *c = history + strlen(vis->undodir) + 1; *c; c++) {
+		if (*c == '/')
+			*c = '%';
+	}
+	return history;
+}
+
+/* restore the undo history of a freshly loaded file */
+static void file_history_load(Vis *vis, File *file) {
+	if (!vis->undofile || !file->name)
+		return;
+	char *history = file_history_name(vis, file->name);
+	if (!history)
+		return;
+	/* a missing or outdated history is not an error */
+	if (!text_history_load(file->text, history) && errno != ENOENT &&
+	    errno != ESTALE && errno != EBUSY)
+		vis_info_show(vis, "Can't restore undo history `%s': %s", history, strerror(errno));
+	free(history);
+}
+
+/* preserve the undo history of a file which was just saved completely */
+void file_history_save(Vis *vis, File *file) {
+	if (!vis->undofile || !file->name)
+		return;
+	char *history = file_history_name(vis, file->name);
+	if (history && !text_history_save(file->text, history))
+		vis_info_show(vis, "Can't store undo history `%s': %s", history, strerror(errno));
+	free(history);
+}
+
+/* flush recorded changes of all files to disk, called when idle */
+static void files_journal_sync(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (text_journal_pending(file->text) && !text_journal_sync(file->text))
+			vis_info_show(vis, "Can't sync journal `%s': %s", file->journal, strerror(errno));
+	}
+}
+
+/* coalesce the content of heavily edited files, called when idle */
+static void files_defragment(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next)
+		text_defragment(file->text, false);
+}
+
+/* watch the file and its directory for external modifications, the latter
+ * is needed to notice when the file is replaced e.g. by means of rename(2) */
+void file_watch(Vis *vis, File *file) {
+#if HAVE_INOTIFY
+	if (vis->inotify == -1 || !file->name || file->internal)
+		return;
+	char *name = strdup(file->name);
+	if (!name)
+		return;
+	const uint32_t file_mask = IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF;
+	const uint32_t dir_mask = IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE;
+	int old[] = { file->watch_file, file->watch_dir };
+	file->watch_file = inotify_add_watch(vis->inotify, file->name, file_mask);
+	file->watch_dir = inotify_add_watch(vis->inotify, dirname(name), dir_mask|IN_ONLYDIR);
+	free(name);
+	/* when re-armed after the file was replaced, the previous inode is
+	 * watched by a different descriptor which is no longer needed */
+	for (size_t i = 0; i < LENGTH(old); i++) {
+		if (old[i] != file->watch_file && old[i] != file->watch_dir)
+			watch_release(vis, old[i]);
+	}
+#endif
+}
+
+/* remove the watch descriptor unless it is still used by some file */
+static void watch_release(Vis *vis, int wd) {
+#if HAVE_INOTIFY
+	if (wd == -1)
+		return;
+	for (File *f = vis->files; f; f = f->next) {
+		if (f->watch_file == wd || f->watch_dir == wd)
+			return;
+	}
+	inotify_rm_watch(vis->inotify, wd);
+#endif
+}
+
+static void file_unwatch(Vis *vis, File *file) {
+	int watches[] = { file->watch_file, file->watch_dir };
+	file->watch_file = file->watch_dir = -1;
+	for (size_t i = 0; i < LENGTH(watches); i++)
+		watch_release(vis, watches[i]);
+}
+
+static bool files_changed(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->changed)
+			return true;
+	}
+	return false;
+}
+
+/* mark files affected by the queued change notifications */
+static void files_watch_read(Vis *vis) {
+#if HAVE_INOTIFY
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(vis->inotify, buf, sizeof buf)) > 0) {
+		for (char *ptr = buf; ptr < buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event*)ptr;
+			ptr += sizeof(*ev) + ev->len;
+			for (File *file = vis->files; file; file = file->next) {
+				bool match = false;
+				if (file->watch_file == ev->wd) {
+					match = true;
+					if (ev->mask & IN_IGNORED)
+						file->watch_file = -1;
+				} else if (file->watch_dir == ev->wd && ev->len) {
+					const char *base = strrchr(file->name, '/');
+					match = base && strcmp(base+1, ev->name) == 0;
+				}
+				if (!match || file->changed)
+					continue;
+				if (!files_changed(vis))
+					clock_gettime(CLOCK_MONOTONIC, &vis->changed_time);
+				file->changed = true;
+			}
+		}
+	}
+#endif
+}
+
+/* apply changes from disk as a new revision, keeping history and marks */
+static bool file_reload(Vis *vis, File *file) {
+	if (!text_reload(file->text, file->name))
+		return false;
+	file->stat = text_stat(file->text);
+	file_journal_open(vis, file);
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file == file)
+			vis_window_invalidate(win);
+	}
+	return true;
+}
+
+/* react to external modifications, which were reported a while ago */
+static void files_changed_process(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (!file->changed)
+			continue;
+		file->changed = false;
+		/* the file might have been replaced, make sure we watch the new one */
+		file_watch(vis, file);
+		struct stat meta;
+		if (stat(file->name, &meta) == -1) {
+			if (errno == ENOENT)
+				vis_info_show(vis, "WARNING: file `%s' was removed", file_name_get(file));
+			continue;
+		}
+		if (meta.st_dev == file->stat.st_dev && meta.st_ino == file->stat.st_ino &&
+		    meta.st_size == file->stat.st_size && stat_mtime_equal(&meta, &file->stat))
+			continue; /* e.g. our own save */
+		if (vis->autoreload && !text_modified(file->text) && file_reload(vis, file))
+			continue;
+		vis_info_show(vis, "WARNING: file `%s' changed on disk", file_name_get(file));
+	}
+}
+
 const char *file_name_get(File *file) {
 	/* TODO: calculate path relative to working directory, cache result */
 	if (!file->name)
@@ -415,22 +662,19 @@ static void window_draw_selections(Win *win) {
 	CellStyle style_cursor = win->ui->style_get(win->ui, UI_STYLE_CURSOR);
 	CellStyle style_cursor_primary = win->ui->style_get(win->ui, UI_STYLE_CURSOR_PRIMARY);
 	CellStyle style_selection = win->ui->style_get(win->ui, UI_STYLE_SELECTION);
-	for (Selection *s = view_selections_prev(sel); s; s = view_selections_prev(s)) {
-		window_draw_selection(win->view, s, &style_selection);
-		size_t pos = view_cursors_pos(s);
-		if (pos < viewport.start)
-			break;
-		window_draw_cursor(win, s, &style_cursor, &style_selection);
-	}
-	window_draw_selection(win->view, sel, &style_selection);
-	window_draw_cursor(win, sel, &style_cursor_primary, &style_selection);
-	for (Selection *s = view_selections_next(sel); s; s = view_selections_next(s)) {
-		window_draw_selection(win->view, s, &style_selection);
+	bool primary = false;
+	for (Selection *s = view_selections_intersect(view, &viewport); s; s = view_selections_next(s)) {
+		primary |= s == sel;
+		window_draw_selection(view, s, &style_selection);
 		size_t pos = view_cursors_pos(s);
 		if (pos > viewport.end)
 			break;
-		window_draw_cursor(win, s, &style_cursor, &style_selection);
+		if (s != sel)
+			window_draw_cursor(win, s, &style_cursor, &style_selection);
 	}
+	if (!primary)
+		window_draw_selection(view, sel, &style_selection);
+	window_draw_cursor(win, sel, &style_cursor_primary, &style_selection);
 }
 
 static void window_draw_eof(Win *win) {
@@ -501,6 +745,8 @@ bool vis_window_reload(Win *win) {
 	const char *name = win->file->name;
 	if (!name)
 		return false; /* can't reload unsaved file */
+	if (file_reload(win->vis, win->file))
+		return true;
 	/* temporarily unset file name, otherwise file_new returns the same File */
 	win->file->name = NULL;
 	File *file = file_new(win->vis, name);
@@ -510,6 +756,9 @@ bool vis_window_reload(Win *win) {
 	file_free(win->vis, win->file);
 	file->refcount = 1;
 	win->file = file;
+	file_history_load(win->vis, file);
+	file_journal_open(win->vis, file);
+	file_watch(win->vis, file);
 	view_reload(win->view, file->text);
 	return true;
 }
@@ -594,8 +843,51 @@ bool vis_window_new(Vis *vis, const char *filename) {
 		file_free(vis, file);
 		return false;
 	}
+	file_history_load(vis, file);
+	file_journal_open(vis, file);
+	file_save_interrupted(vis, file);
+	file_watch(vis, file);
+	return true;
+}
 
+bool vis_window_recover(Vis *vis, const char *filename) {
+	/* unsaved changes are recorded relative to the content an interrupted
+	 * save started to overwrite, restore it first */
+	bool rolledback = text_save_rollback(filename);
+	if (!rolledback && errno != ENOENT)
+		return false;
+	if (rolledback) {
+		char *journal = file_journal_name(filename);
+		bool changes = journal && access(journal, F_OK) == 0;
+		free(journal);
+		if (!changes)
+			return vis_window_new(vis, filename);
+	}
+	File *file = file_new(vis, filename);
+	if (!file)
+		return false;
+	if (file->journal || text_modified(file->text)) {
+		/* already open, possibly with changes which are not in the journal */
+		errno = EBUSY;
+		return false;
+	}
+	if (!(file->journal = file_journal_name(file->name)))
+		goto err;
+	if (!text_journal_recover(file->text, file->journal)) {
+		int saved_errno = errno;
+		free(file->journal);
+		file->journal = NULL;
+		errno = saved_errno;
+		goto err;
+	}
+	if (!window_new_file(vis, file, UI_OPTION_STATUSBAR|UI_OPTION_SYMBOL_EOF))
+		goto err;
+	file_watch(vis, file);
 	return true;
+err:
+	if (!file->refcount)
+		file_free(vis, file);
+	return false;
 }
 
 bool vis_window_new_fd(Vis *vis, int fd) {
@@ -671,6 +963,8 @@ Vis *vis_new(Ui *ui, VisEvent *event) {
 	if (!vis)
 		return NULL;
 	vis->exit_status = -1;
+	vis->inotify = -1;
+	vis->waits = 1;
 	vis->ui = ui;
 	vis->tabwidth = 8;
 	vis->expandtab = false;
@@ -708,6 +1002,9 @@ Vis *vis_new(Ui *ui, VisEvent *event) {
 		shell = "/bin/sh";
 	if (!(vis->shell = strdup(shell)))
 		goto err;
+#if HAVE_INOTIFY
+	vis->inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+#endif
 	vis->mode_prev = vis->mode = &vis_modes[VIS_MODE_NORMAL];
 	vis->event = event;
 	if (event) {
@@ -734,6 +1031,8 @@ void vis_free(Vis *vis) {
 	file_free(vis, vis->error_file);
 	for (int i = 0; i < LENGTH(vis->registers); i++)
 		register_release(&vis->registers[i]);
+	if (vis->inotify != -1)
+		close(vis->inotify);
 	vis->ui->free(vis->ui);
 	if (vis->usercmds) {
 		const char *name;
@@ -761,6 +1060,7 @@ void vis_free(Vis *vis) {
 		vis_action_free(vis, array_get_ptr(&vis->actions_user, 0));
 	array_release(&vis->actions_user);
 	free(vis->shell);
+	free(vis->undodir);
 	free(vis);
 }
 
@@ -772,15 +1072,56 @@ void vis_insert(Vis *vis, size_t pos, const char *data, size_t len) {
 	vis_window_invalidate(win);
 }
 
+/* number of bytes overwritten when replacing text at pos with data */
+static size_t replace_size(Text *txt, size_t pos, const char *data, size_t len) {
+	Iterator it = text_iterator_get(txt, pos);
+	int chars = text_char_count(data, len);
+	for (char c; chars-- > 0 && text_iterator_byte_get(&it, &c) && c != '\n'; )
+		text_iterator_char_next(&it, NULL);
+	return it.pos - pos;
+}
+
+/* Apply the edits, one for each selection in order, in a single pass and
+ * place every cursor after its inserted text. Falls back to individual
+ * modifications if the edits are unordered, e.g. due to overlapping selections.
+ * These operate on the already modified text, hence the number of bytes to
+ * replace is determined anew at the current cursor position. */
+static void selections_edit(Win *win, Array *edits, bool replace) {
+	Text *txt = win->file->text;
+	size_t count = array_length(edits), inserted = 0, deleted = 0, i = 0;
+	bool batch = count > 0 && text_edit(txt, array_get(edits, 0), count);
+	for (Selection *s = view_selections(win->view); s && i < count; s = view_selections_next(s), i++) {
+		TextEdit *e = array_get(edits, i);
+		size_t pos = e->pos + inserted - deleted;
+		if (batch) {
+			inserted += e->len;
+			deleted += e->del;
+		} else {
+			pos = view_cursors_pos(s);
+			size_t del = e->del;
+			if (replace)
+				del = pos == EPOS ? 0 : replace_size(txt, pos, e->data, e->len);
+			text_delete(txt, pos, del);
+			text_insert(txt, pos, e->data, e->len);
+		}
+		view_cursors_scroll_to(s, pos + e->len);
+	}
+	vis_window_invalidate(win);
+}
+
 void vis_insert_key(Vis *vis, const char *data, size_t len) {
 	Win *win = vis->win;
 	if (!win)
 		return;
+	Array edits;
+	array_init_sized(&edits, sizeof(TextEdit));
 	for (Selection *s = view_selections(win->view); s; s = view_selections_next(s)) {
-		size_t pos = view_cursors_pos(s);
-		vis_insert(vis, pos, data, len);
-		view_cursors_scroll_to(s, pos + len);
+		TextEdit e = { .pos = view_cursors_pos(s), .data = data, .len = len };
+		if (!array_add(&edits, &e))
+			break;
 	}
+	selections_edit(win, &edits, false);
+	array_release(&edits);
 }
 
 void vis_replace(Vis *vis, size_t pos, const char *data, size_t len) {
@@ -788,12 +1129,7 @@ void vis_replace(Vis *vis, size_t pos, const char *data, size_t len) {
 	if (!win)
 		return;
 	Text *txt = win->file->text;
-	Iterator it = text_iterator_get(txt, pos);
-	int chars = text_char_count(data, len);
-	for (char c; chars-- > 0 && text_iterator_byte_get(&it, &c) && c != '\n'; )
-		text_iterator_char_next(&it, NULL);
-
-	text_delete(txt, pos, it.pos - pos);
+	text_delete(txt, pos, replace_size(txt, pos, data, len));
 	vis_insert(vis, pos, data, len);
 }
 
@@ -801,11 +1137,22 @@ void vis_replace_key(Vis *vis, const char *data, size_t len) {
 	Win *win = vis->win;
 	if (!win)
 		return;
+	Text *txt = win->file->text;
+	Array edits;
+	array_init_sized(&edits, sizeof(TextEdit));
 	for (Selection *s = view_selections(win->view); s; s = view_selections_next(s)) {
 		size_t pos = view_cursors_pos(s);
-		vis_replace(vis, pos, data, len);
-		view_cursors_scroll_to(s, pos + len);
+		TextEdit e = {
+			.pos = pos,
+			.del = pos == EPOS ? 0 : replace_size(txt, pos, data, len),
+			.data = data,
+			.len = len,
+		};
+		if (!array_add(&edits, &e))
+			break;
 	}
+	selections_edit(win, &edits, true);
+	array_release(&edits);
 }
 
 void vis_delete(Vis *vis, size_t pos, size_t len) {
@@ -1351,6 +1698,13 @@ bool vis_signal_handler(Vis *vis, int signum, const siginfo_t *siginfo, const vo
 	return false;
 }
 
+/* idle time in seconds after which recorded changes are synced to the journal
+ * and fragmented files are compacted */
+#define JOURNAL_SYNC_TIMEOUT 1
+/* delay in milliseconds after the first external change notification until
+ * the affected files are checked, coalesces bursts of writes */
+#define CHANGE_DELAY 100
+
 int vis_run(Vis *vis) {
 	if (!vis->windows)
 		return EXIT_SUCCESS;
@@ -1373,6 +1727,9 @@ int vis_run(Vis *vis) {
 		fd_set fds;
 		FD_ZERO(&fds);
 		FD_SET(STDIN_FILENO, &fds);
+		if (vis->inotify != -1)
+			FD_SET(vis->inotify, &fds);
+		int nfds = register_copy_watch(vis, &fds, MAX(STDIN_FILENO, vis->inotify));
 
 		if (vis->sigbus) {
 			char *name = NULL;
@@ -1392,8 +1749,10 @@ int vis_run(Vis *vis) {
 			free(name);
 		}
 
-		if (vis->terminate)
+		if (vis->terminate) {
+			files_journal_sync(vis);
 			vis_die(vis, "Killed by SIGTERM\n");
+		}
 		if (vis->interrupted) {
 			vis->interrupted = false;
 			vis_keys_push(vis, "<C-c>", 0, true);
@@ -1411,19 +1770,48 @@ int vis_run(Vis *vis) {
 		}
 
 		vis_update(vis);
-		idle.tv_sec = vis->mode->idle_timeout;
-		int r = pselect(1, &fds, NULL, NULL, timeout, &emptyset);
+		idle.tv_sec = vis->mode->idle ? vis->mode->idle_timeout : JOURNAL_SYNC_TIMEOUT;
+		struct timespec *wait = timeout, delay = { 0 };
+		bool changed = files_changed(vis);
+		if (changed) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long elapsed = (now.tv_sec - vis->changed_time.tv_sec) * 1000 +
+			               (now.tv_nsec - vis->changed_time.tv_nsec) / 1000000;
+			if (elapsed < CHANGE_DELAY)
+				delay.tv_nsec = (CHANGE_DELAY - elapsed) * 1000000;
+			wait = &delay;
+		}
+		vis->waits++;
+		int r = pselect(nfds + 1, &fds, NULL, NULL, wait, &emptyset);
 		if (r == -1 && errno == EINTR)
 			continue;
 
 		if (r < 0) {
-			/* TODO save all pending changes to a ~suffixed file */
-			vis_die(vis, "Error in mainloop: %s\n", strerror(errno));
+			int error = errno;
+			files_journal_sync(vis);
+			vis_die(vis, "Error in mainloop: %s\n", strerror(error));
+		}
+
+		if (r == 0 && changed) {
+			files_changed_process(vis);
+			continue;
+		}
+
+		if (vis->inotify != -1 && FD_ISSET(vis->inotify, &fds)) {
+			files_watch_read(vis);
+			if (!FD_ISSET(STDIN_FILENO, &fds))
+				continue;
 		}
 
+		if (register_copy_check(vis, &fds) && !FD_ISSET(STDIN_FILENO, &fds))
+			continue;
+
 		if (!FD_ISSET(STDIN_FILENO, &fds)) {
 			if (vis->mode->idle)
 				vis->mode->idle(vis);
+			files_journal_sync(vis);
+			files_defragment(vis);
 			timeout = NULL;
 			continue;
 		}
@@ -1435,8 +1823,8 @@ int vis_run(Vis *vis) {
 		while ((key = getkey(vis)))
 			vis_keys_push(vis, key, 0, true);
 
-		if (vis->mode->idle)
-			timeout = &idle;
+		/* any input might have fragmented a file */
+		timeout = &idle;
 	}
 	return vis->exit_status;
 }
@@ -1447,7 +1835,7 @@ Macro *macro_get(Vis *vis, enum VisRegister id) {
 	if (VIS_REG_A <= id && id <= VIS_REG_Z)
 		id -= VIS_REG_A;
 	if (id < LENGTH(vis->registers))
-		return array_get(&vis->registers[id].values, 0);
+		return register_slot_buffer(&vis->registers[id], 0);
 	return NULL;
 }
 
@@ -1710,16 +2098,18 @@ Regex *vis_regex(Vis *vis, const char *pattern) {
 	return regex;
 }
 
-int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
+/* feed either the given range of the file or, if non-NULL, input_len bytes of input to the process */
+static int pipe_input(Vis *vis, File *file, Filerange *range, const char *input, size_t input_len, const char *argv[],
 	void *stdout_context, ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len),
 	void *stderr_context, ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len)) {
 
 	/* if an invalid range was given, stdin (i.e. key board input) is passed
 	 * through the external command. */
-	Text *text = file->text;
+	Text *text = file ? file->text : NULL;
 	int pin[2], pout[2], perr[2], status = -1;
-	bool interactive = !text_range_valid(range);
-	Filerange rout = interactive ? text_range_new(0, 0) : *range;
+	bool interactive = !input && !text_range_valid(range);
+	Filerange rout = input ? text_range_new(0, input_len) :
+	                 interactive ? text_range_new(0, 0) : *range;
 
 	if (pipe(pin) == -1)
 		return -1;
@@ -1770,7 +2160,7 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 			 * closed. Some programs behave differently when used
 			 * in a pipeline.
 			 */
-			if (text_range_size(range) == 0)
+			if (text_range_size(&rout) == 0)
 				dup2(null, STDIN_FILENO);
 			else
 				dup2(pin[0], STDIN_FILENO);
@@ -1804,7 +2194,7 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 		close(perr[1]);
 		close(null);
 
-		if (file->name) {
+		if (file && file->name) {
 			char *name = strrchr(file->name, '/');
 			setenv("vis_filepath", file->name, 1);
 			setenv("vis_filename", name ? name+1 : file->name, 1);
@@ -1856,7 +2246,11 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 			Filerange junk = rout;
 			if (junk.end > junk.start + PIPE_BUF)
 				junk.end = junk.start + PIPE_BUF;
-			ssize_t len = text_write_range(text, &junk, pin[1]);
+			ssize_t len;
+			if (input)
+				len = write(pin[1], input + junk.start, text_range_size(&junk));
+			else
+				len = text_write_range(text, &junk, pin[1]);
 			if (len > 0) {
 				rout.start += len;
 				if (text_range_size(&rout) == 0) {
@@ -1936,18 +2330,76 @@ err:
 	return status;
 }
 
+int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
+	void *stdout_context, ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len),
+	void *stderr_context, ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len)) {
+	return pipe_input(vis, file, range, NULL, 0, argv, stdout_context, read_stdout, stderr_context, read_stderr);
+}
+
+pid_t vis_pipe_async(Vis *vis, File *file, Filerange *range, const char *argv[], int *err) {
+	int perr[2];
+	if (pipe(perr) == -1) {
+		vis_info_show(vis, "Failed to create pipe: %s", strerror(errno));
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		close(perr[0]);
+		close(perr[1]);
+		vis_info_show(vis, "fork failure: %s", strerror(errno));
+		return -1;
+	} else if (pid == 0) {
+		/* the writer feeds the command and exits with its status */
+		sigset_t sigterm_mask;
+		sigemptyset(&sigterm_mask);
+		sigaddset(&sigterm_mask, SIGTERM);
+		sigprocmask(SIG_UNBLOCK, &sigterm_mask, NULL);
+		close(perr[0]);
+		dup2(perr[1], STDERR_FILENO);
+		close(perr[1]);
+		int null = open("/dev/null", O_RDWR), pin[2];
+		if (null == -1 || pipe(pin) == -1) {
+			fprintf(stderr, "failed to create pipe");
+			_exit(EXIT_FAILURE);
+		}
+		dup2(null, STDOUT_FILENO);
+		pid_t cmd = fork();
+		if (cmd == 0) {
+			dup2(text_range_size(range) ? pin[0] : null, STDIN_FILENO);
+			close(pin[0]);
+			close(pin[1]);
+			close(null);
+			execvp(argv[0], (char* const*)argv);
+			fprintf(stderr, "%s: %s", argv[0], strerror(errno));
+			_exit(EXIT_FAILURE);
+		}
+		close(pin[0]);
+		/* write from the snapshot of the text taken by fork(2) */
+		if (cmd != -1 && text_range_size(range))
+			text_write_range(file->text, range, pin[1]);
+		close(pin[1]);
+		int status;
+		if (cmd == -1 || waitpid(cmd, &status, 0) != cmd)
+			_exit(EXIT_FAILURE);
+		_exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+	}
+	close(perr[1]);
+	*err = perr[0];
+	return pid;
+}
+
 static ssize_t read_buffer(void *context, char *data, size_t len) {
 	buffer_append(context, data, len);
 	return len;
 }
 
-int vis_pipe_collect(Vis *vis, File *file, Filerange *range, const char *argv[], char **out, char **err) {
+static int pipe_collect(Vis *vis, File *file, Filerange *range, const char *input, size_t input_len, const char *argv[], char **out, char **err) {
 	Buffer bufout, buferr;
 	buffer_init(&bufout);
 	buffer_init(&buferr);
-	int status = vis_pipe(vis, file, range, argv,
-	                      &bufout, out ? read_buffer : NULL,
-	                      &buferr, err ? read_buffer : NULL);
+	int status = pipe_input(vis, file, range, input, input_len, argv,
+	                        &bufout, out ? read_buffer : NULL,
+	                        &buferr, err ? read_buffer : NULL);
 	buffer_terminate(&bufout);
 	buffer_terminate(&buferr);
 	if (out)
@@ -1959,6 +2411,14 @@ int vis_pipe_collect(Vis *vis, File *file, Filerange *range, const char *argv[],
 	return status;
 }
 
+int vis_pipe_collect(Vis *vis, File *file, Filerange *range, const char *argv[], char **out, char **err) {
+	return pipe_collect(vis, file, range, NULL, 0, argv, out, err);
+}
+
+int vis_pipe_buf_collect(Vis *vis, const char *buf, size_t len, const char *argv[], char **out, char **err) {
+	return pipe_collect(vis, NULL, NULL, buf, len, argv, out, err);
+}
+
 bool vis_cmd(Vis *vis, const char *cmdline) {
 	if (!cmdline)
 		return true;
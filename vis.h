@@ -202,7 +202,15 @@ bool vis_window_new(Vis*, const char *filename);
  * @endrst
  */
 bool vis_window_new_fd(Vis*, int fd);
-/** Reload the file currently displayed in the window from disk. */
+/**
+ * Create a new window and recover unsaved changes of the given file.
+ *
+ * Replays the journal left behind by a previous editing session which
+ * did not terminate normally. An interrupted incremental save of the file
+ * is rolled back beforehand, see ``text_save_rollback``.
+ */
+bool vis_window_recover(Vis*, const char *filename);
+/** Reload the file currently displayed in the window from disk, see ``text_reload``. */
 bool vis_window_reload(Win*);
 /** Check whether closing the window would loose unsaved changes. */
 bool vis_window_closable(Win*);
@@ -922,6 +930,21 @@ int vis_pipe(Vis*, File*, Filerange*, const char *argv[],
  */
 int vis_pipe_collect(Vis*, File*, Filerange*, const char *argv[], char **out, char **err);
 
+/**
+ * Pipe a buffer to an external process, return its exit status and capture
+ * everything that is written to stdout/stderr.
+ * @param buf The data to write to ``stdin``.
+ * @param len The length of the data, it may contain ``NUL`` bytes.
+ * @param argv Argument list, must be ``NULL`` terminated.
+ * @param out Data written to ``stdout``, will be ``NUL`` terminated.
+ * @param err Data written to ``stderr``, will be ``NUL`` terminated.
+ * @rst
+ * .. warning:: The pointers stored in ``out`` and ``err`` need to be `free(3)`-ed
+ *              by the caller.
+ * @endrst
+ */
+int vis_pipe_buf_collect(Vis*, const char *buf, size_t len, const char *argv[], char **out, char **err);
+
 /**
  * @}
  * @defgroup vis_keys